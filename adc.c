@@ -1,13 +1,39 @@
-#include "msp430f2274.h"
+#include "hal.h"
 #include "interrupts.h"
+#include "adc.h"
 
 #define  ADS_NUMBER_OF_CHANNELS 4
+#define ADC_BATTERY 0 // adc_data[0] is A3 (battery), adc_data[1..3] are A2-A0 (accelerometer)
 static unsigned int adc_data[ADS_NUMBER_OF_CHANNELS];
+/**
+ * Battery voltage changes slowly, so only every battery_divider-th sequence (ADC_BATTERY_HZ)
+ * includes A3: the rest convert A2-A0 only (INCH_2, 3 conversions, DTC starts at adc_data + 1
+ * so every channel stays at its place in adc_data). The battery is not averaged,
+ * adc_battery_updated() tells whether a new battery value arrived.
+ */
+static unsigned int battery_divider; // sequences per battery measurement at the current period
+static unsigned int battery_countdown; // sequences left until the next one with the battery
+static bool battery_sequence; // the running sequence includes the battery
+static volatile bool battery_ready; // new battery value in adc_data[ADC_BATTERY], set by adc10_isr
+static bool battery_updated; // adc_average[ADC_BATTERY] is new since the previous adc_get_data()
+/**
+ * Oversampling: every conversion of the sequence is added into the fill accumulator
+ * and counted. adc_get_data() swaps the accumulators with interrupts disabled
+ * and turns the idle one into averages with ADC_EXTRA_BITS extra resolution bits
+ * (value = mean * 2^ADC_EXTRA_BITS, 10.6 fixed point, still 2 bytes per channel).
+ * The count saturates at ADC_MAX_COUNT, so sum << ADC_EXTRA_BITS fits 32 bits:
+ * 1023 * 0x3FFF * 64 < 2^32.
+ */
+#define ADC_EXTRA_BITS 6
+#define ADC_MAX_COUNT 0x3FFF
 // двойная буфферизация
-static unsigned int adc_accumulator_0[ADS_NUMBER_OF_CHANNELS];
-static unsigned int adc_accumulator_1[ADS_NUMBER_OF_CHANNELS];
+static unsigned long adc_accumulator_0[ADS_NUMBER_OF_CHANNELS];
+static unsigned long adc_accumulator_1[ADS_NUMBER_OF_CHANNELS];
+static unsigned int adc_counts[2];
 static unsigned char adc_accumulator_index = 0;
-static unsigned int* adc_accumulator_fill = adc_accumulator_0;
+static unsigned long* adc_accumulator_fill = adc_accumulator_0;
+static unsigned int* adc_count_fill = &adc_counts[0];
+static unsigned int adc_average[ADS_NUMBER_OF_CHANNELS];
 
 
 void adc_init(){
@@ -24,6 +50,7 @@ void adc_init(){
   ADC10CTL0 |= (ADC10SR + REFBURST + REF2_5V);           //Reference buffer for 50ksps max, 2.5v, buffer only on during conversion 
   ADC10CTL0 |= (REFON + ADC10IE + MSC);                  //Reference on, interrupts on, converting the whole sequence via a single trigger
   ADC10CTL1 |= (INCH_3 + ADC10DIV_1 + ADC10SSEL_1 + CONSEQ_1); //Choose A3-A0 as inputs, clock=ACLK/3, sequence of channels single conversion
+  ADC10CTL1 |= SHS_1;                                    //Sequence is triggered by Timer_A OUT1 (see adc_start)
   ADC10AE0 |= (BIT0 + BIT1 + BIT2 + BIT3);                     //Arming pins for ADC
   //DMA settings
   ADC10DTC1 = 0x04;                                      //We will transfer 4 conversions at a time
@@ -32,40 +59,123 @@ void adc_init(){
 
 /* --------------------- Конвертация по 4м каналам -------------------- */
 
-void adc_convert_begin(){
-    // disable conversion to allow change
-    // Все делают но нам скорей всего не надо потому как мы тут в ADC ничего не настраиваем
-    //DC10CTL0 &= ~ENC;
-    while(ADC10CTL1 & BUSY);              // Wait if ADC10 busy
-    ADC10SA = (unsigned int)(adc_data);   //Start address of the acc data buffer
-    ADC10CTL0 |= ENC + ADC10SC;           //Start conversion
+// choose the channels of the next sequence, ENC must be cleared
+static void adc_next_sequence(){
+    ADC10CTL1 &= ~INCH_3;
+    if (--battery_countdown == 0) {
+        battery_countdown = battery_divider;
+        battery_sequence = true;
+        ADC10CTL1 |= INCH_3;                       //A3-A0
+        ADC10DTC1 = 4;
+        ADC10SA = HAL_ADDRESS(adc_data);
+    } else {
+        battery_sequence = false;
+        ADC10CTL1 |= INCH_2;                       //A2-A0
+        ADC10DTC1 = 3;
+        ADC10SA = HAL_ADDRESS(adc_data + 1);
+    }
+}
+
+/**
+ * Conversions are paced by Timer_A, independent of the ADS DRDY and of the main loop:
+ * Timer_A counts ACLK/8 (2 MHz) in up mode, OUT1 (set/reset) rises once per period
+ * and triggers the A3-A0 sequence, the DTC moves it into adc_data,
+ * and adc10_isr re-arms the sequence for the next trigger.
+ * period - in 1/ADC_TIMER_HZ units, e.g. ADC_TIMER_HZ/1000 for 1 kHz,
+ * out of range (see adc_period_valid) means ADC_DEFAULT_PERIOD.
+ */
+void adc_start(unsigned int period){
+    if (!adc_period_valid(period)) {
+        period = ADC_DEFAULT_PERIOD;
+    }
+    adc_stop();
+    for (int i = 0; i < ADS_NUMBER_OF_CHANNELS; ++i) { // drop the sums left from the previous recording
+        adc_accumulator_0[i] = adc_accumulator_1[i] = 0;
+    }
+    adc_counts[0] = adc_counts[1] = 0;
+    battery_divider = ADC_TIMER_HZ / ADC_BATTERY_HZ / period;
+    battery_countdown = 1;                //The very first sequence measures the battery
+    battery_ready = false;
+    adc_next_sequence();
+    ADC10CTL0 |= ENC;                     //Wait for the timer trigger
+    TACCR0 = period - 1;
+    TACCR1 = period >> 1;
+    TACCTL1 = OUTMOD_3;                   //set at TACCR1, reset at TACCR0: one rising edge per period
+    TACTL = TASSEL_1 + ID_3 + MC_1 + TACLR; //ACLK/8, up mode
+}
+
+// the period fits Timer_A and leaves the sequence time to finish before the next trigger
+bool adc_period_valid(unsigned int period){
+    return period >= ADC_MIN_PERIOD && period <= ADC_MAX_PERIOD;
+}
+
+void adc_stop(){
+    TACTL = 0;                            //Timer stopped, no more triggers
+    ADC10CTL0 &= ~ENC;                    //A running sequence is finished by the ADC itself
 }
 /* -------------------------------------------------------------------------- */
 
+/**
+ * Returns the averages of all conversions since the previous call
+ * (adc_data layout: A3, A2, A1, A0, little endian, mean * 2^ADC_EXTRA_BITS).
+ * The battery (A3) is the latest single conversion (also * 2^ADC_EXTRA_BITS).
+ * Must be called once per frame: every call starts a new averaging interval.
+ * If there was no conversion in the interval the previous averages are repeated.
+ */
 unsigned char* adc_get_data(){
-    unsigned char* data = (unsigned char*) adc_accumulator_fill;
-    // переключаемся на второй буффер и обнуляем его значения
+    unsigned long* sums = adc_accumulator_fill;
+    unsigned int* count = adc_count_fill;
+    // переключаемся на второй буффер атомарно: ISR не должен писать в буфер который мы читаем
+    INTERRUPTS_DISABLE();
     if(adc_accumulator_index == 0) {
         adc_accumulator_index = 1;
         adc_accumulator_fill = adc_accumulator_1;
-
+        adc_count_fill = &adc_counts[1];
     } else {
         adc_accumulator_index = 0;
         adc_accumulator_fill = adc_accumulator_0;
+        adc_count_fill = &adc_counts[0];
+    }
+    battery_updated = battery_ready;
+    battery_ready = false;
+    if (battery_updated) {
+        adc_average[ADC_BATTERY] = adc_data[ADC_BATTERY] << ADC_EXTRA_BITS;
     }
-    for (int i = 0; i < ADS_NUMBER_OF_CHANNELS; ++i) {
-        adc_accumulator_fill[i] = 0;
+    INTERRUPTS_ENABLE();
+    // буфер sums теперь не используется ISR: считаем средние и обнуляем его для следующего переключения
+    if (*count != 0) {
+        for (int i = ADC_BATTERY + 1; i < ADS_NUMBER_OF_CHANNELS; ++i) {
+            adc_average[i] = (unsigned int)((sums[i] << ADC_EXTRA_BITS) / *count); // (деление раз в фрейм)
+            sums[i] = 0;
+        }
+        *count = 0;
     }
-    return data;
+    return (unsigned char*) adc_average;
 }
 
-#pragma vector=ADC10_VECTOR
-__interrupt void adc10_isr(void){
+// true if the last adc_get_data() returned a new battery value
+bool adc_battery_updated(){
+    return battery_updated;
+}
+
+HAL_ISR(ADC10_VECTOR, adc10_isr){
  //uart_send_bytes(sizeof(adc_data), (unsigned char*)adc_data);
  //Approximating Acc data
-    for (int i = 0; i < ADS_NUMBER_OF_CHANNELS; ++i) {
-        adc_accumulator_fill[i] += adc_data[i];
+    // single sequence mode with a timer trigger: ENC has to be toggled
+    // and the DTC restarted before the next sequence
+    ADC10CTL0 &= ~ENC;
+    if (battery_sequence) {
+        battery_ready = true; // adc_data[ADC_BATTERY] is not touched until the next battery sequence
+    }
+    if (*adc_count_fill != ADC_MAX_COUNT) {
+        for (int i = ADC_BATTERY + 1; i < ADS_NUMBER_OF_CHANNELS; ++i) {
+            adc_accumulator_fill[i] += adc_data[i];
+        }
+        (*adc_count_fill)++;
+    }
+    if (TACTL & MC_1) {
+        adc_next_sequence();
+        ADC10CTL0 |= ENC;
     }
-    interrupt_flag = true;
-    __low_power_mode_off_on_exit();
+    // no event: the averages are pulled by databatch when a frame is made
 }
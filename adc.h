@@ -1,4 +1,20 @@
+#ifndef ADC_H
+#define ADC_H
+
+#include <stdbool.h>
+
+#define ADC_TIMER_HZ 2000000 // Timer_A clock: ACLK/8
+#define ADC_DEFAULT_PERIOD (ADC_TIMER_HZ / 1000) // accelerometer at 1 kHz
+// the A3-A0 sequence (4 x (64 + 13) ADC10CLK) and the 50 ksps reference buffer limit: 10 kHz at most
+#define ADC_MIN_PERIOD (ADC_TIMER_HZ / 10000)
+#define ADC_MAX_PERIOD 0xFFFF // 16-bit TACCR0: 30.5 Hz at least
+#define ADC_BATTERY_HZ 1 // battery once a second at any period
+
 void adc_init();
-void adc_convert_begin();
+bool adc_period_valid(unsigned int period);
+void adc_start(unsigned int period);
+void adc_stop();
 unsigned char* adc_get_data();
+bool adc_battery_updated();
 
+#endif //ADC_H
@@ -1,4 +1,4 @@
-#include "msp430f2274.h"
+#include "hal.h"
 #include <stdbool.h>
 #include "bynary.h"
 #include "utypes.h"
@@ -6,6 +6,7 @@
 #include "uart_spi.h"
 #include "ads1292.h"
 #include "interrupts.h"
+#include "timer.h"
 
 /**
  * ADS выставляет флаг(бит) DRDY (data ready) когда данные готовы.
@@ -26,29 +27,109 @@
 
 
 #define NULL 0
-#define ADS_NUMBER_OF_CHANNELS 2
-#define ADS_SAMPLE_SIZE 9 // одно измерение: 3 байта служебные + 3 байта канал 1 + 3 байта канал 2
+#define ADS_SAMPLE_SIZE (ADS_SAMPLE_BYTES * (ADS_NUMBER_OF_CHANNELS + 1)) // одно измерение: 3 байта служебные + по 3 байта на канал
 
 // указатель на функцию без параметров например "void func()" определяется следующим образом: void (*func)(void)
 // и дальше этому указателю можно присваивать адрес любой  соответсвующей функции и вызывать ее просто как func();
 /** указатель на внешнюю функцию которая будет вызываться из прерывания DRDY (ads данные готовы) */
 static void (*DRDY_interrupt_callback)(void);
 
-/*******  double buffer for ads samples ******/
-static uchar sample_buffer_0[ADS_SAMPLE_SIZE];
-static uchar sample_buffer_1[ADS_SAMPLE_SIZE];
-static uchar* fill_buffer = sample_buffer_0; // ссылка на буфер для заполнения
-static uchar* display_buffer = sample_buffer_1;  //ссылка на заполненный буфер готовый для обработки
+/**
+ * Данные ADS читаются по SPI без промежуточного буфера (zero-copy):
+ * 3 байта каждого канала сразу ложатся в слот, адрес которого лежит в sample_slots.
+ * sample_slots[0] - слово статуса (хранится здесь же), sample_slots[1..] - каналы.
+ * Слоты каналов назначает потребитель данных (databatch) через ads_channel_slots(),
+ * обычно это место очередного измерения канала прямо в отправляемом фрейме.
+ * Байты каждого слота записываются в обратном порядке, т.е. сразу в Little Endian.
+ */
+static uchar status_buffer[ADS_SAMPLE_BYTES];
+static uchar skipped_sample[ADS_SAMPLE_BYTES]; // сюда пишутся каналы пока им не назначены слоты
+static uchar* sample_slots[ADS_NUMBER_OF_CHANNELS + 1];
 /**********************************************************/
 
 static bool data_ready;
-static bool data_receiving;
 static bool data_received;
 
-#define DELAY_32()   __delay_cycles(32)
-#define DELAY_64()   __delay_cycles(64)
-#define DELAY_320()   __delay_cycles(320)
-#define DELAY_450000()   __delay_cycles(450000)
+static bool recording;
+// измерения потерянные прошивкой с начала записи (ads_sample_overruns): очередь sample_queue полна
+// или (чтение из main loop) пришел DRDY, а предыдущее измерение еще не начали читать
+static volatile uint sample_overruns;
+
+#ifdef ADS_READ_IN_DRDY_ISR
+/**
+ * Очередь измерений прочитанных в PORT1_ISR (байты в порядке прихода по SPI).
+ * sample_queue_head меняет только PORT1_ISR, sample_queue_tail - только main loop.
+ * Если очередь полна, новое измерение выбрасывается (считается в sample_overruns).
+ */
+#define ADS_SAMPLE_QUEUE_SIZE 4 // в очереди может быть не больше ADS_SAMPLE_QUEUE_SIZE - 1 измерений
+static uchar sample_queue[ADS_SAMPLE_QUEUE_SIZE][ADS_SAMPLE_SIZE];
+static volatile uchar sample_queue_head;
+static volatile uchar sample_queue_tail;
+static volatile bool sample_pending; // DRDY пришел пока SPI занят командой ADS
+
+static uchar next_sample(uchar index) {
+    index++;
+    if (index == ADS_SAMPLE_QUEUE_SIZE) {
+        index = 0;
+    }
+    return index;
+}
+#else
+static bool data_receiving; // измерение читается по SPI из main loop
+#endif
+
+/**
+ * Команды ADS (опкоды и данные регистров) не блокируют процессор: они ставятся в очередь транзакций,
+ * а байты транзакции отправляет по SPI прерывание (ads_spi_complete вызывается из RX_ISR
+ * по окончании каждого байта и через паузу 4 tCLK на таймере запускает следующий).
+ * Транзакция запускается из main loop (ads_process) только когда SPI
+ * свободен от чтения измерений, а измерение, пришедшее во время транзакции, читается после нее.
+ * Во время записи (RDATAC) ADS игнорирует RREG/WREG, поэтому такие команды
+ * оборачиваются в SDATAC ... RDATAC внутри одной транзакции.
+ * Последнее место в очереди оставлено для старта/остановки записи: их можно поставить
+ * даже когда очередь заполнена командами регистров.
+ * transaction_head меняет только main loop, transaction_tail - только прерывание.
+ */
+#define ADS_TRANSACTION_MAX_SIZE (ADS_NUMBER_OF_REGISTERS + 4) // SDATAC + WREG (2 байта) + все регистры + RDATAC
+#define ADS_TRANSACTION_QUEUE_SIZE 4 // в очереди может быть не больше ADS_TRANSACTION_QUEUE_SIZE - 1 транзакций
+typedef struct {
+    uchar data[ADS_TRANSACTION_MAX_SIZE]; // байты для отправки
+    uchar size;
+    uchar read_index; // read_size байт принятых начиная с этого кладутся в read_to
+    uchar read_size; // 0 - ничего не читаем
+    uchar* read_to;
+} ads_transaction;
+static ads_transaction transactions[ADS_TRANSACTION_QUEUE_SIZE];
+static volatile uchar transaction_head;
+static volatile uchar transaction_tail;
+static volatile bool transaction_running; // байты транзакции transaction_tail отправляются
+static uchar transaction_byte; // индекс следующего байта транзакции
+
+static uchar next_transaction(uchar index) {
+    index++;
+    if (index == ADS_TRANSACTION_QUEUE_SIZE) {
+        index = 0;
+    }
+    return index;
+}
+
+/**
+ * Включение ADS идет по таймеру (timer.h) как смена состояний, процессор в это время спит
+ * и может обрабатывать команды UART. Команды ADS уходят только после ADS_STATE_READY.
+ */
+#define ADS_POWER_UP_DELAY  TIMER_US(28125) // от включения до сброса
+#define ADS_RESET_PULSE     TIMER_US(4)     // длительность импульса RESET
+#define ADS_RESET_DELAY     TIMER_US(20)    // от сброса до первой команды
+#define ADS_COMMAND_GAP     TIMER_US(2)     // 4 tCLK между байтами и командами
+
+typedef enum {
+    ADS_STATE_POWER_UP,
+    ADS_STATE_RESET,
+    ADS_STATE_RESET_RELEASE,
+    ADS_STATE_STOP_CONTINUOUS, // SDATAC после сброса
+    ADS_STATE_READY
+} ADS_STATE;
+static volatile ADS_STATE ads_state;
 
 /******** ADS ONE BYTE COMMANDS (from data sheet) *********/
 typedef enum {
@@ -76,9 +157,126 @@ static uchar test_reg_values[] = {0x02, //reg 0x01  Set sampling ratio to 500 SP
                                   0x03}; //reg 0x0A Set RLDREF_INT
 
 
-static void ads_write_command1(ADS_COMMAND command) {
-    spi_exchange(command);
-    DELAY_32();
+/**
+ * Новая транзакция в конце очереди (0 если очередь полна).
+ * Байты добавляются через ads_transaction_put, транзакция уходит в очередь по ads_transaction_commit.
+ * @param start_stop true - старт/остановка записи, может занять последнее место в очереди
+ */
+static ads_transaction* ads_transaction_begin(bool start_stop) {
+    uchar head = transaction_head;
+    uchar next = next_transaction(head);
+    if (next == transaction_tail || (!start_stop && next_transaction(next) == transaction_tail)) {
+        return 0;
+    }
+    ads_transaction* transaction = &transactions[head];
+    transaction->size = 0;
+    transaction->read_size = 0;
+    // во время записи (RDATAC) ADS принимает команды только после SDATAC
+    if (recording) {
+        transaction->data[transaction->size++] = ADS_DISABLE_CONTINUOUS_MODE;
+    }
+    return transaction;
+}
+
+static void ads_transaction_put(ads_transaction* transaction, uchar byte) {
+    transaction->data[transaction->size++] = byte;
+}
+
+static void ads_transaction_commit(ads_transaction* transaction) {
+    if (recording) {
+        ads_transaction_put(transaction, ADS_ENABLE_CONTINUOUS_MODE);
+    }
+    transaction_head = next_transaction(transaction_head);
+    EVENT_SET(EVENT_ADS_COMMAND);
+}
+
+// запускает отправку следующего байта транзакции transaction_tail
+static void ads_transaction_send_byte() {
+    ads_transaction* transaction = &transactions[transaction_tail];
+    uchar index = transaction_byte++;
+    uchar read_offset = index - transaction->read_index;
+    if (read_offset < transaction->read_size) { // index >= read_index (при index < read_index разность переполняется)
+        spi_read(transaction->read_to + read_offset, 1); // отправляется 0, принятый байт - значение регистра
+    } else {
+        spi_transmit(&transaction->data[index], 1);
+    }
+}
+
+#ifdef ADS_READ_IN_DRDY_ISR
+static void ads_read_sample();
+#endif
+
+// вызывается из прерывания таймера после паузы между байтами команды
+static void ads_command_gap_done() {
+    if (transaction_byte < transactions[transaction_tail].size) {
+        ads_transaction_send_byte();
+        return;
+    }
+    transaction_tail = next_transaction(transaction_tail);
+    transaction_running = false;
+    EVENT_SET(EVENT_ADS_COMMAND);
+#ifdef ADS_READ_IN_DRDY_ISR
+    if (sample_pending) { // DRDY пришел во время транзакции
+        sample_pending = false;
+        ads_read_sample();
+    }
+#else
+    if (data_ready) { // DRDY пришел во время транзакции: чтение запустит ads_data_received (databatch_process)
+        EVENT_SET(EVENT_ADS_DATA);
+    }
+#endif
+}
+
+static void ads_bring_up();
+
+// вызывается из RX_ISR когда неблокирующий SPI обмен завершен
+static void ads_spi_complete() {
+    if (transaction_running) { // байт команды отправлен
+        timer_start(TIMER_ADS, ADS_COMMAND_GAP, ads_command_gap_done);
+    } else if (ads_state == ADS_STATE_STOP_CONTINUOUS) { // SDATAC включения отправлен
+        timer_start(TIMER_ADS, ADS_COMMAND_GAP, ads_bring_up);
+    } else { // завершилось чтение измерения
+        EVENT_SET(EVENT_ADS_DATA);
+    }
+}
+
+/**
+ * Запускает очередную транзакцию ADS если SPI свободен. Вызывается из main loop
+ */
+void ads_process() {
+    if (ads_state != ADS_STATE_READY) {
+        return;
+    }
+#ifndef ADS_READ_IN_DRDY_ISR
+    // чтение измерения важнее: транзакция запускается только когда измерение не ждет чтения
+    if (data_ready || data_receiving) {
+        return;
+    }
+#endif
+    INTERRUPTS_DISABLE(); // PORT1_ISR не должен начать чтение измерения одновременно с транзакцией
+    if (!transaction_running && transaction_tail != transaction_head) {
+        transaction_running = true;
+        transaction_byte = 0;
+        ads_transaction_send_byte();
+    }
+    INTERRUPTS_ENABLE();
+}
+
+/**
+ * @return true если все команды ADS выполнены (в том числе прочитаны регистры из ads_read_regs)
+ */
+bool ads_commands_finished() {
+    return transaction_tail == transaction_head;
+}
+
+static bool ads_write_command1(ADS_COMMAND command) {
+    ads_transaction* transaction = ads_transaction_begin(false);
+    if (transaction == 0) {
+        return false;
+    }
+    ads_transaction_put(transaction, command);
+    ads_transaction_commit(transaction);
+    return true;
 }
 
 
@@ -90,6 +288,30 @@ static void ads_test_config() {
     ads_write_regs(0x01, test_reg_values, sizeof(test_reg_values));
 }
 
+static uchar stop_continuous_command = ADS_DISABLE_CONTINUOUS_MODE;
+
+// шаги включения ADS, вызываются из прерывания таймера
+static void ads_bring_up() {
+    if (ads_state == ADS_STATE_POWER_UP) {
+        ads_state = ADS_STATE_RESET;
+        P4OUT &= ~BIT5;  // ads reset
+        timer_start(TIMER_ADS, ADS_RESET_PULSE, ads_bring_up);
+    } else if (ads_state == ADS_STATE_RESET) {
+        ads_state = ADS_STATE_RESET_RELEASE;
+        P4OUT |= BIT5; // ads releasing
+        timer_start(TIMER_ADS, ADS_RESET_DELAY, ads_bring_up);
+    } else if (ads_state == ADS_STATE_RESET_RELEASE) {
+        P4OUT &= ~BIT4; //Selecting ADS as SPI slave for microcontroller
+        // после сброса ADS в режиме RDATAC и игнорирует RREG/WREG, а вне записи транзакции идут без SDATAC.
+        // Команда уходит отсюда, не занимая очередь транзакций, ads_spi_complete продолжит через 4 tCLK
+        ads_state = ADS_STATE_STOP_CONTINUOUS;
+        spi_transmit(&stop_continuous_command, 1);
+    } else if (ads_state == ADS_STATE_STOP_CONTINUOUS) {
+        ads_state = ADS_STATE_READY; // main loop (ads_process) может отправлять команды
+        EVENT_SET(EVENT_ADS_COMMAND);
+    }
+}
+
 void ads_init() {
     //Configuring ports
     //4.4=CS, 4.5=RESET, 4.6=START, 1.2=DRDY
@@ -114,100 +336,119 @@ void ads_init() {
     //TBCTL |= MC_3;
     //Startup,
 
-    //Releasing ADS, wait for it to start and then reset
-   
+    //Releasing ADS, wait for it to start and then reset (ads_bring_up)
+    ads_state = ADS_STATE_POWER_UP;
     P4OUT |= BIT5;
-    DELAY_450000(); // стас говорит что в этой процедуре не проходят прерывания
-    P4OUT &= ~BIT5;  // ads reset
-    DELAY_64();
-    P4OUT |= BIT5; // ads releasing
-    DELAY_320();
+    timer_start(TIMER_ADS, ADS_POWER_UP_DELAY, ads_bring_up);
 
-    P4OUT &= ~BIT4; //Selecting ADS as SPI slave for microcontroller
+    sample_slots[0] = status_buffer;
+    for (uchar i = 1; i <= ADS_NUMBER_OF_CHANNELS; i++) {
+        sample_slots[i] = skipped_sample;
+    }
+    spi_transfer_callback(ads_spi_complete);
     //ads_test_config();
 }
 
 /**
- * Запись подряд нескольких регистров
+ * Запись подряд нескольких регистров (неблокирующая, данные копируются в очередь команд)
  * @param addres - starting register address
  * @param data указатель на массив данных
- * @param data_size размер данных
+ * @param data_size размер данных (не больше ADS_NUMBER_OF_REGISTERS)
+ * @return false если очередь команд полна
  */
-void ads_write_regs(uchar address, uchar* data, uchar data_size) {
-   
+bool ads_write_regs(uchar address, uchar* data, uchar data_size) {
+    if (data_size == 0 || data_size > ADS_NUMBER_OF_REGISTERS) {
+        return false;
+    }
+    ads_transaction* transaction = ads_transaction_begin(false);
+    if (transaction == 0) {
+        return false;
+    }
     //The Register Write command is a two-byte opcode followed by the input of the register data.
     //First opcode byte: 010r rrrr, where r rrrr is the starting register address.
     //Second opcode byte: 000n nnnn, where n nnnn is the (number of registers to write – 1)
-    uchar opcode_first_byte = address | B01000000;
-    uchar opcode_second_byte = data_size - 1; // (number of registers to write – 1)
-    // отправляем команду записи в регистр
-    spi_exchange(opcode_first_byte);
-    spi_exchange(opcode_second_byte);
+    ads_transaction_put(transaction, address | B01000000);
+    ads_transaction_put(transaction, data_size - 1); // (number of registers to write – 1)
     for (uchar i = 0; i < data_size; i++) {
-        spi_exchange(data[i]);  // write data
+        ads_transaction_put(transaction, data[i]);
     }
-    DELAY_32();
+    ads_transaction_commit(transaction);
+    return true;
 }
 
 /**
- * запись одного регистра
- * @param address адресс регистра
- * @param data данные для записи в регистр
- */
-/*void ads_write_1_reg(uchar address, uchar data) {
-   
-    //The Register Write command is a two-byte opcode followed by the input of the register data.
-    //First opcode byte: 010r rrrr, where r rrrr is the starting register address.
-    //Second opcode byte: 000n nnnn, where n nnnn is the (number of registers to write – 1)
-    uchar opcode_first_byte = address | B01000000;
-    uchar opcode_second_byte = 0x00; // (number of registers to write – 1) = 0
-    // отправляем команду записи в регистр
-    spi_exchange(opcode_first_byte);
-    spi_exchange(opcode_second_byte);
-    spi_exchange(data); //Writing one byte
-    DELAY_32();
-}*/
-
-/**
- * Чтение одного реристра. Возращает прочитанное значение
+ * Чтение подряд нескольких реристров (неблокирующее).
+ * Прочитанные значения будут записаны в values когда ads_commands_finished() вернет true
+ * @param data_size число регистров (не больше ADS_NUMBER_OF_REGISTERS)
+ * @return false если очередь команд полна
  */
-uchar ads_read_reg(uchar address) {
-    
+bool ads_read_regs(uchar address, uchar* values, uchar data_size) {
+    if (data_size == 0 || data_size > ADS_NUMBER_OF_REGISTERS) {
+        return false;
+    }
+    ads_transaction* transaction = ads_transaction_begin(false);
+    if (transaction == 0) {
+        return false;
+    }
     //The Register Read command is a two-byte opcode followed by the output of the register data.
     //First opcode byte: 001r rrrr, where r rrrr is the starting register address.
     //Second opcode byte: 000n nnnn, where n nnnn is the number of registers to read – 1.
-    uchar opcode_first_byte = address | B00100000;
-    uchar opcode_second_byte = 0x00; // (number of registers to read – 1) = 0
-    // отправляем команду чтения из регистра
-    spi_exchange(opcode_first_byte);
-    spi_exchange(opcode_second_byte);
-    // отправляем 0 чтобы прочитать данные
-    uchar ads_data = spi_exchange(0x00); //Reading one byte
-    return ads_data;
+    ads_transaction_put(transaction, address | B00100000);
+    ads_transaction_put(transaction, data_size - 1); // (number of registers to read – 1)
+    // отправляем нули чтобы прочитать данные
+    transaction->read_index = transaction->size;
+    transaction->read_size = data_size;
+    transaction->read_to = values;
+    for (uchar i = 0; i < data_size; i++) {
+        ads_transaction_put(transaction, 0x00);
+    }
+    ads_transaction_commit(transaction);
+    return true;
 }
 
-void ads_stop_recording() {
-    //Данные по SPI получаются в асинхронном режиме основанном на прерываниях
-    // А все комманды отправляются в синхронном ждущем режиме без прерываний.
-    // Эти два режима нельзя смешивать!
-    // Поэтому перед тем как отправлять команды ждем окончания асинхронного приема данных по SPI
-    spi_flush();
-    ads_write_command1(ADS_DISABLE_CONTINUOUS_MODE); // stop continuous recording
-    ads_write_command1(ADS_STOP); //ads stop
+/**
+ * Команды остановки ставятся в очередь и уйдут в ADS когда закончится текущий обмен по SPI
+ * @return false если очередь команд полна (запись не остановлена)
+ */
+bool ads_stop_recording() {
+    bool was_recording = recording;
+    recording = false; // транзакция остановки сама начинается с SDATAC
+    ads_transaction* transaction = ads_transaction_begin(true);
+    if (transaction == 0) {
+        recording = was_recording;
+        return false;
+    }
+    ADS_DRDY_INTERRUPT_DISABLE();
+    ads_transaction_put(transaction, ADS_DISABLE_CONTINUOUS_MODE); // stop continuous recording
+    ads_transaction_put(transaction, ADS_STOP); //ads stop
+    ads_transaction_commit(transaction);
+    return true;
 }
 
-void ads_start_recording() {
+/**
+ * @return false если очередь команд полна (запись не запущена)
+ */
+bool ads_start_recording() {
+    ads_transaction* transaction = ads_transaction_begin(true);
+    if (transaction == 0) {
+        return false;
+    }
     ADS_DRDY_INTERRUPT_DISABLE(); //disable interrupt on DRDY чтобы прерывания не нарушали процесс старта
     // очищаем флаги
     ADS_DRDY_FLAG_CLEAR(); //Clearing interrput flag DRDY
     data_ready = false;
-    data_receiving = false;
     data_received = false;
-    // Ждем окончания асинхронного приема данных по SPI (на всякий случай)
-    spi_flush();
-    ads_write_command1(ADS_ENABLE_CONTINUOUS_MODE); // enable continuous recording
-    ads_write_command1(ADS_START); //start recording
+    ads_transaction_put(transaction, ADS_ENABLE_CONTINUOUS_MODE); // enable continuous recording
+    ads_transaction_put(transaction, ADS_START); //start recording
+    ads_transaction_commit(transaction);
+    sample_overruns = 0;
+#ifdef ADS_READ_IN_DRDY_ISR
+    sample_queue_head = sample_queue_tail = 0;
+    sample_pending = false;
+#endif
+    recording = true;
     ADS_DRDY_INTERRUPT_ENABLE(); //Enabling the interrupt on DRDY
+    return true;
 }
 
 // метод передает указатель на конкретную функцию которая будет вызываться в DRDY прерывании (данные готовы)
@@ -219,11 +460,48 @@ uchar ads_number_of_signals() {
     return ADS_NUMBER_OF_CHANNELS;
 }
 
+/**
+ * Возвращает массив из ADS_NUMBER_OF_CHANNELS адресов по которым будут записаны
+ * 3 байта (Little Endian) каждого канала при следующем чтении данных.
+ * Менять адреса можно только после того как ads_data_received() вернул true
+ * (и до следующего вызова ads_data_received())
+ */
+uchar** ads_channel_slots() {
+    return sample_slots + 1;
+}
+
+/**
+ * Возвращает true (один раз на каждое измерение) когда данные очередного измерения
+ * уже лежат в слотах назначенных через ads_channel_slots()
+ */
 bool ads_data_received() {
-    if (data_ready) {
+#ifdef ADS_READ_IN_DRDY_ISR
+    uchar tail = sample_queue_tail;
+    if (tail == sample_queue_head) {
+        return false;
+    }
+    // раскладываем измерение по слотам, каждую группу в обратном порядке (Little Endian)
+    uchar* sample = sample_queue[tail];
+    for (uchar i = 0; i <= ADS_NUMBER_OF_CHANNELS; i++) {
+        uchar* slot = sample_slots[i];
+        slot[2] = sample[0];
+        slot[1] = sample[1];
+        slot[0] = sample[2];
+        sample += ADS_SAMPLE_BYTES;
+    }
+    sample_queue_tail = next_sample(tail);
+    return true;
+#else
+    if (data_receiving && spi_transfer_finished()) {
+        data_receiving = false;
+        data_received = true;
+    }
+    // новое чтение запускаем только когда предыдущее измерение забрано,
+    // потребитель успел назначить новые слоты и SPI не занят командой ADS
+    if (data_ready && !data_receiving && !data_received && !transaction_running) {
         /****** Обработчик прерывания *****/
-        // запускаем чтение данных из ADS по SPI
-        spi_read(fill_buffer, ADS_SAMPLE_SIZE);
+        // запускаем чтение данных из ADS по SPI прямо в слоты
+        spi_read_scattered(sample_slots, ADS_SAMPLE_SIZE, ADS_SAMPLE_BYTES);
         // вызвываем callback функцию если ее адрес не нулевой
         if (*DRDY_interrupt_callback != NULL) {
             DRDY_interrupt_callback();
@@ -232,58 +510,64 @@ bool ads_data_received() {
         data_receiving = true;
         /*************************************/
     }
-    if (data_receiving && spi_transfer_finished() ) {
-        // swap double buffers
-        uchar* tmp = display_buffer;
-        display_buffer = fill_buffer;
-        fill_buffer = tmp;
-        data_receiving = false;
-        data_received = true;
+    if (data_received) {
+        data_received = false;
+        return true;
     }
-    return data_received;
+    return false;
+#endif
 }
 
 /**
- * Перед тем как получить данные убедиться что они готовы. Метод ads_data_ready()!
- *
- * Возвращает ссылку на массив из 3 * ADS_NUMBER_OF_CHANNELS  байт:
- * 3 байта от первого канала
- * 3 байта от второго канала
- * ...
- * Порядок байт?
+ * Перед тем как получить значение лофф статуса
+ * убедиться что данные от ADS считаны. Метод ads_data_received()
+ * Слово статуса ADS1292: 1100|LOFF_STAT[4:0]|GPIO[1:0]|13 нулей
+ * LOFF_STAT: бит 4 - RLD, 3 - IN2N, 2 - IN2P, 1 - IN1N, 0 - IN1P (1 - электрод отключен)
+ * Слово статуса записано в обратном порядке: status_buffer[2] - первый пришедший байт
  */
-uchar* ads_get_data() {
-    //Dropping the first 3 bytes from ADS (там служебная информация)
-    data_received = false;
-    return display_buffer + 3;
-}
-
 /**
- * Перед тем как получить значение лофф статуса
- * убедиться что данные от ADS считаны. Метод ads_data_ready()
+ * @return сколько измерений ADS потеряно прошивкой с начала записи (не прочитано или не поместилось в очередь)
  */
-// скопировано у Саши. Разобраться что за 3 служебных байта выдает ADS
+uint ads_sample_overruns() {
+    return sample_overruns;
+}
+
 uchar ads_get_loff_status() {
-    uchar result = ((display_buffer[0] << 1) & 0x0E) | ((display_buffer[1] >> 7) & 0x01);
+    uchar result = ((status_buffer[2] << 1) & 0x1E) | ((status_buffer[1] >> 7) & 0x01);
     return result;
 }
 
-#pragma vector=PORT1_VECTOR
+#ifdef ADS_READ_IN_DRDY_ISR
+// вызывается только из прерываний
+static void ads_read_sample() {
+    uchar head = sample_queue_head;
+    uchar next_head = next_sample(head);
+    spi_read_polled(sample_queue[head], ADS_SAMPLE_SIZE); // ячейка head всегда свободна
+    if (next_head == sample_queue_tail) { // очередь полна, измерение выбрасываем
+        sample_overruns++;
+    } else {
+        sample_queue_head = next_head;
+        EVENT_SET(EVENT_ADS_DATA);
+    }
+}
+#endif
 
-__interrupt void PORT1_ISR(void) {
+HAL_ISR(PORT1_VECTOR, PORT1_ISR) {
     if (ADS_DRDY_FLAG_CHECK()) { //if interrput from DRDY
-        data_ready = true; // выставляем флаг
         ADS_DRDY_FLAG_CLEAR();
+#ifdef ADS_READ_IN_DRDY_ISR
+        if (transaction_running) {
+            sample_pending = true; // прочитаем по окончании команды (ads_spi_complete)
+        } else {
+            ads_read_sample(); // читаем измерение сразу, пока ADS не выдал следующее
+        }
+#else
+        if (data_ready) { // предыдущее измерение так и не прочитано, ADS его уже заменил
+            sample_overruns++;
+        }
+        data_ready = true; // выставляем флаг
+        EVENT_SET(EVENT_ADS_DATA);
+#endif
     }
-    interrupt_flag = true;
-    __low_power_mode_off_on_exit();
+    EVENTS_WAKE_UP();
 }
-
-
-
-
-
-
-
-
-
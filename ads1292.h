@@ -4,15 +4,30 @@
 #include "bynary.h"
 #include "utypes.h"
 
+#define ADS_NUMBER_OF_CHANNELS 2
+#define ADS_SAMPLE_BYTES 3 // одно измерение канала (и слово статуса) занимает 3 байта
+#define ADS_NUMBER_OF_REGISTERS 12 // регистры 0x00 - 0x0B
+
+/**
+ * Если определено, измерение ADS читается по SPI прямо в прерывании DRDY (опрос флагов SPI,
+ * без прерываний на каждый байт) и кладется в очередь измерений, main loop только забирает их.
+ * Задержка от DRDY до чтения не зависит от загрузки main loop (нужно для 1-8 kSPS).
+ * Без этой опции чтение запускает main loop в ads_data_received().
+ */
+//#define ADS_READ_IN_DRDY_ISR
 
 void ads_init();
-uchar ads_read_reg(uchar address);
-void ads_write_regs(uchar address, uchar* data, uchar data_size);
-void ads_start_recording();
+bool ads_read_regs(uchar address, uchar* values, uchar data_size);
+bool ads_write_regs(uchar address, uchar* data, uchar data_size);
+bool ads_commands_finished();
+void ads_process();
+bool ads_start_recording();
 uchar ads_number_of_signals();
-void ads_stop_recording();
+bool ads_stop_recording();
 bool ads_data_received();
-uchar* ads_get_data();
+uchar ads_get_loff_status();
+uint ads_sample_overruns();
+uchar** ads_channel_slots();
 void ads_DRDY_interrupt_callback(void (*func)(void));
 
 
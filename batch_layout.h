@@ -0,0 +1,77 @@
+#ifndef BATCH_LAYOUT_H
+#define BATCH_LAYOUT_H
+
+#include "ads1292.h"
+
+/**======================== Раскладка фрейма данных ======================
+ * Раскладка описана здесь один раз (X-macro), из нее на этапе компиляции получаются
+ * смещения полей (enum) для каждой конфигурации фрейма и специализированные
+ * функции упаковки хвоста (см. DEFINE_PACK_TAIL в databatch.c).
+ * Во время работы (в том числе в make_batch) никакой арифметики размеров - только константы.
+ *
+ * заголовок | данные ADS | хвост
+ *
+ * Данные ADS - области каналов, их размер зависит от делителей каналов
+ * и считается один раз в databatch_start().
+ */
+
+/**
+ * Поля заголовка: X(name, size)
+ */
+#define BATCH_HEADER_FIELDS(X) \
+    X(START, 1)               \
+    X(MARKER, 1)              \
+    X(COUNTER, 2)
+
+// у сжатого фрейма за обычным заголовком идут размер битового потока и параметры кода Райса каналов
+#define COMPRESSED_HEADER_FIELDS(X)    \
+    BATCH_HEADER_FIELDS(X)              \
+    X(PAYLOAD_SIZE, 2)                  \
+    X(RICE_PARAMETERS, ADS_NUMBER_OF_CHANNELS)
+
+/**
+ * Поля хвоста: X(config, name, size, option)
+ * option - бит конфигурации при котором поле присутствует во фрейме (0 - поле есть всегда).
+ * CRC считается по всем полям хвоста перед ним.
+ */
+#define ADS_LOFF_SIZE ((ADS_NUMBER_OF_CHANNELS > 2) ? 2 : 1) // 1 байт для двухканалки, 2 для восьмиканалки
+
+#define BATCH_TAIL_FIELDS(X, config)                        \
+    X(config, ACCELEROMETER, 6, 0)                          \
+    X(config, BATTERY, 2, LAYOUT_BATTERY)                   \
+    X(config, LEAD_OFF, ADS_LOFF_SIZE, LAYOUT_LEAD_OFF)     \
+    X(config, CRC, 2, 0)                                    \
+    X(config, STOP, 1, 0)
+
+// биты конфигурации (необязательные поля хвоста)
+#define LAYOUT_BATTERY  0x01
+#define LAYOUT_LEAD_OFF 0x02
+#define LAYOUT_CONFIGS  4 // все сочетания битов конфигурации
+
+/*------------------------- генерируемые смещения -------------------------*/
+#define LAYOUT_FIELD_SIZE(size, option, config) ((((option) == 0) || (((config) & (option)) != 0)) ? (size) : 0)
+
+/**
+ * Смещения полей получаются цепочкой enum: после NAME идет NAME_LAST = NAME + size - 1,
+ * и следующее поле автоматически получает смещение NAME + size
+ * (поле нулевого размера получает то же смещение что и следующее).
+ */
+#define HEADER_FIELD_OFFSET(name, size) HEADER_##name, HEADER_##name##_LAST = HEADER_##name + (size) - 1,
+enum { BATCH_HEADER_FIELDS(HEADER_FIELD_OFFSET) BATCH_HEADER_SIZE };
+
+#define COMPRESSED_HEADER_FIELD_OFFSET(name, size) COMPRESSED_##name, COMPRESSED_##name##_LAST = COMPRESSED_##name + (size) - 1,
+enum { COMPRESSED_HEADER_FIELDS(COMPRESSED_HEADER_FIELD_OFFSET) COMPRESSED_HEADER_SIZE };
+
+#define TAIL_FIELD_OFFSET(config, name, size, option) \
+    TAIL_##config##_##name, TAIL_##config##_##name##_LAST = TAIL_##config##_##name + LAYOUT_FIELD_SIZE(size, option, config) - 1,
+#define DEFINE_TAIL_LAYOUT(config) enum { BATCH_TAIL_FIELDS(TAIL_FIELD_OFFSET, config) TAIL_##config##_SIZE };
+
+DEFINE_TAIL_LAYOUT(0)
+DEFINE_TAIL_LAYOUT(1)
+DEFINE_TAIL_LAYOUT(2)
+DEFINE_TAIL_LAYOUT(3)
+
+// самый длинный хвост - со всеми необязательными полями
+#define MAX_TAIL_SIZE TAIL_3_SIZE
+
+#endif //BATCH_LAYOUT_H
@@ -1,9 +1,13 @@
 #include <stdbool.h>
+#include <string.h>
 #include "utypes.h"
 #include "uart_spi.h"
 #include "ads1292.h"
 #include "databatch.h"
+#include "adc.h"
 #include "leds.h"
+#include "hal.h"
+#include "interrupts.h"
 
 #define FRAME_START  0xAA
 #define FRAME_STOP 0x55
@@ -14,6 +18,13 @@ FRAME_START|COMMAND_START|frame size(bytes)|COMMAND_MARKER|...|COMMAND_NEED_CONF
 Комманды высокой надежности, которые требуют подтверждения, сначала посылаются
 назад и выполняются только после того как придет подтверждение что команда принята правильно
 
+command that need confirm, tagged with sequence id:
+FRAME_START|COMMAND_START|frame size(bytes)|COMMAND_MARKER|...|sequence_id|COMMAND_NEED_CONFIRM_TAGGED|FRAME_STOP
+Такие команды тоже посылаются назад, но ждут подтверждения в таблице (до PENDING_COMMANDS команд),
+так что хост может отправить несколько команд не дожидаясь эха каждой.
+Выполняется команда по COMMAND_CONFIRMED с тем же sequence_id. Команда с уже ждущим sequence_id
+заменяет прежнюю, если таблица полна - команда отбрасывается и вместо эха приходит MESSAGE_REJECTED_MARKER.
+
 command that do not need confirm:
 FRAME_START|COMMAND_START|frame size(bytes)|COMMAND_MARKER|...|FRAME_STOP|FRAME_STOP
 Обычные команды, не требующие подтверждения, выполняются сразу
@@ -21,6 +32,7 @@ FRAME_START|COMMAND_START|frame size(bytes)|COMMAND_MARKER|...|FRAME_STOP|FRAME_
 
 #define COMMAND_START 0x5A
 #define COMMAND_NEED_CONFIRM 0xCC
+#define COMMAND_NEED_CONFIRM_TAGGED 0xCD
 
 /****** COMMANDS MARKERS *************/
 // Processor registers addresses are 16bit (2 bytes) LITTLE ENDIAN
@@ -43,9 +55,45 @@ FRAME_START|COMMAND_START|frame size(bytes)|COMMAND_MARKER|...|FRAME_STOP|FRAME_
 #define ADS_REGISTER_READ              0xA7
 // FRAME_START|COMMAND_START|0X07|PROCESSOR_REGISTER_READ|reg_address|FRAME_STOP|FRAME_STOP
 
+/****** BULK COMMANDS MARKERS *************/
+// Несколько регистров/байт одним фреймом: число записываемых значений следует из размера фрейма
+#define ADS_REGISTERS_WRITE            0xB0
+// FRAME_START|COMMAND_START|0X07+n|ADS_REGISTERS_WRITE|start_address|value_1|...|value_n|COMMAND_NEED_CONFIRM|FRAME_STOP
+// n от 1 до ADS_NUMBER_OF_REGISTERS
+
+#define ADS_REGISTERS_READ             0xB1
+// FRAME_START|COMMAND_START|0X08|ADS_REGISTERS_READ|start_address|n|FRAME_STOP|FRAME_STOP
+// в ответ приходят n байт значений регистров (как и на ADS_REGISTER_READ - без обрамления),
+// при n = 0 или n > ADS_NUMBER_OF_REGISTERS - MESSAGE_REJECTED_MARKER
+
+#define PROCESSOR_MEMORY_WRITE         0xB2
+// FRAME_START|COMMAND_START|0X08+n|PROCESSOR_MEMORY_WRITE|address_bottom|address_top|byte_1|...|byte_n|COMMAND_NEED_CONFIRM|FRAME_STOP
+
+#define PROCESSOR_MEMORY_READ          0xB3
+// FRAME_START|COMMAND_START|0X09|PROCESSOR_MEMORY_READ|address_bottom|address_top|n|FRAME_STOP|FRAME_STOP
+// в ответ приходят n байт памяти начиная с address (без обрамления), при n = 0 - MESSAGE_REJECTED_MARKER
+
+#define STATUS_REQUEST                 0xB4
+// FRAME_START|COMMAND_START|0X06|STATUS_REQUEST|FRAME_STOP|FRAME_STOP
+// в ответ приходит MESSAGE_STATUS_MARKER со счетчиками потерь
+
 #define ADS_START_RECORDING            0xA8
 // FRAME_START|COMMAND_START|0X08|ADS_START_RECORDING|divider_1|divider_2|COMMAND_NEED_CONFIRM|FRAME_STOP (двухканалка)
 // FRAME_START|COMMAND_START|0X0E|ADS_START_RECORDING|divider_1|...|divider_8|COMMAND_NEED_CONFIRM|FRAME_STOP (восьмиканалка)
+// после делителей может идти необязательный байт опций (DATABATCH_COMPRESSED...), размер фрейма тогда на 1 больше:
+// FRAME_START|COMMAND_START|0X09|ADS_START_RECORDING|divider_1|divider_2|options|COMMAND_NEED_CONFIRM|FRAME_STOP
+// за опциями может идти необязательный байт длины записи (число измерений ADS во фрейме, 0 - по умолчанию 10):
+// FRAME_START|COMMAND_START|0X0A|ADS_START_RECORDING|divider_1|divider_2|options|record_length|COMMAND_NEED_CONFIRM|FRAME_STOP
+// за длиной записи могут идти 2 байта периода ADC (акселерометр) в тактах Timer_A (ADC_TIMER_HZ), little endian,
+// от ADC_MIN_PERIOD до ADC_MAX_PERIOD, иначе (и без них) - ADC_DEFAULT_PERIOD (1 kHz):
+// FRAME_START|COMMAND_START|0X0C|ADS_START_RECORDING|divider_1|divider_2|options|record_length|period_bottom|period_top|COMMAND_NEED_CONFIRM|FRAME_STOP
+// в ответ приходит MESSAGE_RECORDING_MARKER с принятой длиной записи
+
+#define UART_BAUD_RATE_SET             0xAF
+// FRAME_START|COMMAND_START|0X07|UART_BAUD_RATE_SET|baud_rate|COMMAND_NEED_CONFIRM|FRAME_STOP
+// baud_rate - индекс скорости (UART_BAUD_xxx в uart_spi.h). После подтверждения (COMMAND_CONFIRMED)
+// ответ MESSAGE_BAUD_RATE_MARKER уходит еще на старой скорости, после чего скорость переключается.
+// Хост переключается на новую скорость получив этот ответ.
 
 // one byte commands
 #define ADS_STOP_RECORDING             0xA9
@@ -55,6 +103,8 @@ FRAME_START|COMMAND_START|frame size(bytes)|COMMAND_MARKER|...|FRAME_STOP|FRAME_
 #define COMMAND_CONFIRMED              0xAE
 // FRAME_START|COMMAND_START|0X06|COMMAND_MARKER|COMMAND_NEED_CONFIRM|FRAME_STOP
 // FRAME_START|COMMAND_START|0X06|COMMAND_MARKER|FRAME_STOP|FRAME_STOP
+// подтверждение команды с sequence_id:
+// FRAME_START|COMMAND_START|0X07|COMMAND_CONFIRMED|sequence_id|FRAME_STOP|FRAME_STOP
 
 /**=========================== MESSAGES FORMAT===============================
 FRAME_START|MESSAGE_START|frame size(bytes)|MESSAGE_MARKER|...|FRAME_STOP
@@ -68,132 +118,605 @@ FRAME_START|MESSAGE_START|frame size(bytes)|MESSAGE_MARKER|...|FRAME_STOP
 #define MESSAGE_HARDWARE_MARKER 0xA4
 // FRAME_START|MESSAGE_START|0X06|MESSAGE_HARDWARE_MARKER|0x02|FRAME_STOP  (двухканалка)
 // FRAME_START|MESSAGE_START|0X06|MESSAGE_HARDWARE_MARKER|0x08|FRAME_STOP (восьмиканалка)
+
+#define MESSAGE_RECORDING_MARKER 0xA8
+// FRAME_START|MESSAGE_START|0X06|MESSAGE_RECORDING_MARKER|record_length|FRAME_STOP
+// принятая длина записи: может отличаться от запрошенной (см. databatch_start)
+
+#define MESSAGE_BAUD_RATE_MARKER 0xAF
+// FRAME_START|MESSAGE_START|0X06|MESSAGE_BAUD_RATE_MARKER|baud_rate|FRAME_STOP
+// baud_rate - новая скорость, 0xFF если такой скорости нет (скорость не меняется)
+
+#define MESSAGE_REJECTED_MARKER 0xA1
+// FRAME_START|MESSAGE_START|0X07|MESSAGE_REJECTED_MARKER|command_marker|sequence_id|FRAME_STOP
+// команда, требующая подтверждения, отброшена: таблица ждущих подтверждения полна
+// (sequence_id - 0 для команды без sequence_id). Хост может повторить ее после подтверждения других.
+// Так же (с sequence_id 0) отвечает команда чтения с неверными аргументами вместо данных
+
+#define MESSAGE_STATUS_MARKER 0xB4
+// FRAME_START|MESSAGE_START|0X0D|MESSAGE_STATUS_MARKER|batch_overruns(2)|sample_overruns(2)|rx_dropped(2)|commands_dropped(2)|FRAME_STOP
+// счетчики little endian, первые два - с начала записи, остальные - с включения:
+// batch_overruns - фреймы записи, выброшенные из-за переполнения очереди отправки
+// sample_overruns - измерения ADS, потерянные прошивкой (не успела прочитать или некуда положить)
+// rx_dropped - принятые байты, потерянные из-за переполнения fifo UART
+// commands_dropped - команды, разобранные и отброшенные без выполнения, чтобы не переполнить fifo UART
+// (отказ MESSAGE_REJECTED_MARKER уходит только если не обгоняет ответ на предыдущую команду)
+
+#define MESSAGE_PING_MARKER 0xAD
+// FRAME_START|MESSAGE_START|0X05|MESSAGE_PING_MARKER|FRAME_STOP
+// ответ на PING: прошивка жива и разбирает команды (в том числе во время записи)
 /**===========================================================================*/
 #define MSG_HELLO_SIZE 0X05
 static uchar message_hello[] = {FRAME_START, MESSAGE_START, MSG_HELLO_SIZE, MESSAGE_HELLO_MARKER, FRAME_STOP};
 #define MSG_HARDWARE_SIZE 0X06
 static uchar message_hardware[] = {FRAME_START, MESSAGE_START, MSG_HARDWARE_SIZE, MESSAGE_HARDWARE_MARKER, 0x02, FRAME_STOP};
+#define MSG_RECORDING_SIZE 0X06
+static uchar message_recording[] = {FRAME_START, MESSAGE_START, MSG_RECORDING_SIZE, MESSAGE_RECORDING_MARKER, 0x0A, FRAME_STOP};
+#define MSG_BAUD_RATE_SIZE 0X06
+static uchar message_baud_rate[] = {FRAME_START, MESSAGE_START, MSG_BAUD_RATE_SIZE, MESSAGE_BAUD_RATE_MARKER, 0x00, FRAME_STOP};
+#define MSG_REJECTED_SIZE 0X07
+static uchar message_rejected[] = {FRAME_START, MESSAGE_START, MSG_REJECTED_SIZE, MESSAGE_REJECTED_MARKER, 0x00, 0x00, FRAME_STOP};
+#define MSG_STATUS_SIZE 0X0D
+static uchar message_status[] = {FRAME_START, MESSAGE_START, MSG_STATUS_SIZE, MESSAGE_STATUS_MARKER,
+                                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, FRAME_STOP};
+#define MSG_PING_SIZE 0X05
+static uchar message_ping[] = {FRAME_START, MESSAGE_START, MSG_PING_SIZE, MESSAGE_PING_MARKER, FRAME_STOP};
 
 #define ADS_MAX_NUMBER_OF_SIGNALS 8
-#define MAX_COMMAND_LENGTH 16
-static uchar buffer0[MAX_COMMAND_LENGTH];
-static uchar buffer1[MAX_COMMAND_LENGTH];
-static uchar* fill_buffer = buffer0; // ссылка на буфер для заполнения
-static uchar* command_buffer = buffer1;
+#define MAX_COMMAND_LENGTH 32 // размер фрейма команды меньше MAX_COMMAND_LENGTH
+#define COMMAND_BYTES_PER_PASS 16 // байт разбирается за один проход main loop
+#define COMMAND_FIFO_RESERVE 16 // свободных байт fifo UART, меньше которых ждущие команды разбираются и отбрасываются
+#define PENDING_COMMANDS 3 // команды ждущие подтверждения
+// буферы принимаемой команды и команд ждущих подтверждения (меняются ролями без копирования)
+static uchar command_buffers[PENDING_COMMANDS + 1][MAX_COMMAND_LENGTH];
+static uchar* fill_buffer = command_buffers[0]; // ссылка на буфер для заполнения (0 - свободного буфера нет)
+static uchar drain_buffer[MAX_COMMAND_LENGTH]; // сюда разбираются отбрасываемые команды, когда свободного буфера нет
+static uint commands_dropped;
+
+typedef struct {
+    uchar* command; // 0 - запись свободна
+    bool tagged; // false - команда с COMMAND_NEED_CONFIRM (без sequence_id)
+    uchar id;
+} pending_command;
+static pending_command pending_commands[PENDING_COMMANDS];
 
 static uchar fill_buffer_index;
 static uchar command_length;
-static bool command_buffered;
 static uchar ads_dividers[ADS_MAX_NUMBER_OF_SIGNALS];
+// ответы отправляются без ожидания (uart_transmit ставит их в очередь),
+// поэтому они должны жить дольше вызова do_command - не на стеке
+static uchar ads_register_values[ADS_NUMBER_OF_REGISTERS];
+static uchar ads_register_read_size; // ответ отправляется когда ADS выполнит чтение регистров
+static uchar broken_char;
+
+/**
+ * Если очередь UART полна (или ждет смены скорости) ответ не теряется: он остается в reply_data
+ * и отправляется в следующих проходах commands_process, а следующие команды до тех пор ждут в fifo.
+ * Буферы ответов message_recording, message_baud_rate, message_rejected, message_status и broken_char переписываются
+ * при выполнении команды, поэтому команды ждут и пока эти буферы стоят в очереди на отправку (replies_waiting).
+ * Так же ждут, пока нет свободного буфера для приема команды (все заняты ждущими подтверждения и эхом).
+ */
+static uchar* reply_data;
+static int reply_size; // 0 - ответ отправлен
+static uchar reply_baud_rate = UART_BAUD_RATES; // скорость переключается после отправки ответа
+
+/**
+ * Команда ADS, не вставшая в очередь транзакций ADS (очередь полна), не теряется: она остается
+ * в deferred_command и выполняется заново когда ADS выполнит команду (EVENT_ADS_COMMAND),
+ * а следующие команды до тех пор ждут в fifo.
+ */
+static uchar* deferred_command;
+static uchar deferred_size;
+
+/**
+ * Размер фрейма выполняемой команды (как frame size, но без sequence_id).
+ * Обработчики берут его отсюда, а не из command[2]: буфер команды с подтверждением
+ * может еще стоять в очереди UART как эхо, поэтому его байты не меняются.
+ */
+static uchar command_size;
+
+static void defer(uchar* command) {
+    deferred_command = command;
+    deferred_size = command_size;
+}
+
+static void reply(uchar* data, int size) {
+    if (!uart_transmit(data, size)) {
+        reply_data = data;
+        reply_size = size;
+    }
+}
+
+// отказ выполнить команду (MESSAGE_REJECTED_MARKER)
+static void reject(uchar marker, uchar id) {
+    message_rejected[4] = marker;
+    message_rejected[5] = id;
+    reply(message_rejected, MSG_REJECTED_SIZE);
+}
+
+// ставит в очередь отложенные ответы
+static void replies_send() {
+    if (reply_size != 0 && uart_transmit(reply_data, reply_size)) {
+        reply_size = 0;
+    }
+    if (reply_size == 0 && reply_baud_rate != UART_BAUD_RATES) { // ответ ушел в очередь на старой скорости
+        uart_set_baud_rate(reply_baud_rate);
+        reply_baud_rate = UART_BAUD_RATES;
+    }
+    if (ads_register_read_size != 0 && ads_commands_finished()
+        && uart_transmit(ads_register_values, ads_register_read_size)) {
+        ads_register_read_size = 0;
+    }
+}
+
+// true если следующие команды должны ждать в fifo
+static bool replies_waiting() {
+    return reply_size != 0 || ads_register_read_size != 0 || deferred_command != 0
+           || fill_buffer == 0 || fill_buffer == drain_buffer
+           || uart_transmit_pending(message_recording) || uart_transmit_pending(message_baud_rate)
+           || uart_transmit_pending(message_rejected) || uart_transmit_pending(message_status)
+           || uart_transmit_pending(&broken_char);
+}
+
+/**
+ * true если ждать нельзя: fifo UART почти полон (или начатая команда разбирается в drain_buffer).
+ * Тогда принятые байты все равно разбираются, но команды не выполняются, а отбрасываются (command_drop),
+ * иначе fifo переполнится и следующие фреймы склеятся из обрывков.
+ */
+static bool fifo_draining(bool waiting) {
+    return waiting && (fill_buffer == drain_buffer || uart_read_space() < COMMAND_FIFO_RESERVE);
+}
+
+// команда разобрана в режиме fifo_draining и не выполняется
+static void command_drop(uchar marker, uchar id) {
+    commands_dropped++;
+    // отказ не должен обогнать ответ на предыдущую команду и затереть еще не отправленный отказ,
+    // иначе команда учитывается только в commands_dropped
+    if (reply_size == 0 && ads_register_read_size == 0 && deferred_command == 0
+        && !uart_transmit_pending(message_rejected)) {
+        reject(marker, id);
+    }
+}
+
+#define REGISTER_ADDRESS(byte_bottom, byte_top) HAL_MEMORY(byte_bottom + (byte_top << 8))
+
+/************** PROCESSOR REGISTERS *******************/
+// Processor register address is 2 bytes. Must be send in little endian order
+static void processor_register_write(uchar *command) {
+    uchar *address = REGISTER_ADDRESS(command[4], command[5]);
+    *address = command[6];
+}
+
+static void processor_register_set_bits(uchar *command) {
+    uchar *address = REGISTER_ADDRESS(command[4], command[5]);
+    *address |= command[6];
+}
+
+static void processor_register_clear_bits(uchar *command) {
+    uchar *address = REGISTER_ADDRESS(command[4], command[5]);
+    *address &= ~command[6];
+}
+
+static void processor_register_read(uchar *command) {
+    uchar *address = REGISTER_ADDRESS(command[4], command[5]);
+    reply(address, 1);
+}
+
+/************** ADS REGISTERS *******************/
+// Ads register address is 1 byte.
+static void ads_register_write(uchar *command) {
+    if (!ads_write_regs(command[4], &command[5], 1)) {
+        defer(command);
+    }
+}
+
+static void ads_register_read(uchar *command) {
+    if (ads_read_regs(command[4], ads_register_values, 1)) {
+        ads_register_read_size = 1;
+    } else {
+        defer(command);
+    }
+}
+
+/************** BULK COMMANDS *******************/
+static void ads_registers_write(uchar *command) {
+    if (!ads_write_regs(command[4], &command[5], command_size - 7)) {
+        defer(command);
+    }
+}
+
+static void ads_registers_read(uchar *command) {
+    if (command[5] == 0 || command[5] > ADS_NUMBER_OF_REGISTERS) {
+        reject(command[3], 0); // хост ждет ответа, поэтому отказ вместо молчания
+    } else if (ads_read_regs(command[4], ads_register_values, command[5])) {
+        ads_register_read_size = command[5];
+    } else {
+        defer(command);
+    }
+}
+
+static void processor_memory_write(uchar *command) {
+    uchar *address = REGISTER_ADDRESS(command[4], command[5]);
+    uchar size = command_size - 8;
+    for (uchar i = 0; i < size; i++) {
+        address[i] = command[6 + i];
+    }
+}
+
+static void processor_memory_read(uchar *command) {
+    uchar *address = REGISTER_ADDRESS(command[4], command[5]);
+    if (command[6] != 0) {
+        reply(address, command[6]); // прямо из памяти, без копирования
+    } else {
+        reject(command[3], 0);
+    }
+}
+
+/************** MACRO COMMANDS *******************/
+static void ads_recording_start(uchar *command) {
+    // старт ставится в очередь ADS первым: если очереди нет места, ничего не меняется
+    if (!ads_start_recording()) {
+        defer(command);
+        return;
+    }
+    uchar number_of_signals = ads_number_of_signals();
+    for (int i = 0; i < number_of_signals; ++i) {
+        ads_dividers[i] = command[4 + i];
+    }
+    uchar options = 0;
+    uchar record_length = 0;
+    uint adc_period = ADC_DEFAULT_PERIOD;
+    // 4 байта заголовка + делители + 2 байта в конце
+    if (command_size > number_of_signals + 6) {
+        options = command[4 + number_of_signals];
+    }
+    if (command_size > number_of_signals + 7) {
+        record_length = command[5 + number_of_signals];
+    }
+    if (command_size > number_of_signals + 9) {
+        adc_period = command[6 + number_of_signals] | (command[7 + number_of_signals] << 8);
+    }
+    // предпоследний байт содержит принятую длину записи
+    message_recording[MSG_RECORDING_SIZE - 2] = databatch_start(ads_dividers, options, record_length);
+    reply(message_recording, MSG_RECORDING_SIZE);
+    adc_start(adc_period);
+}
 
-#define REGISTER_ADDRESS(byte_bottom, byte_top) ((unsigned char*)byte_bottom + (byte_top << 8))
-
-// TODO PING
-static void do_command(uchar *command) {
-    uchar command_marker = command[3];
-    /************** PROCESSOR REGISTERS *******************/
-    // Processor register address is 2 bytes. Must be send in little endian order
-    if (command_marker == PROCESSOR_REGISTER_WRITE) {
-        uchar *address = REGISTER_ADDRESS(command[4], command[5]);
-        *address = command[6];
-    } else if (command_marker == PROCESSOR_REGISTER_SET_BITS) {
-        uchar *address = REGISTER_ADDRESS(command[4], command[5]);
-        *address |= command[6];
-    } else if (command_marker == PROCESSOR_REGISTER_CLEAR_BITS) {
-        uchar *address = REGISTER_ADDRESS(command[4], command[5]);
-        *address &= ~command[6];
-    } else if (command_marker == PROCESSOR_REGISTER_READ) {
-        uchar *address = REGISTER_ADDRESS(command[4], command[5]);
-        uart_flush(); // ждем завершения отправки по uart
-        uart_transmit(address, 1);
-    }
-        /************** ADS REGISTERS *******************/
-        // Ads register address is 1 byte.
-    else if (command_marker == ADS_REGISTER_WRITE) {
-        ads_write_regs(command[4], &command[5], 1);
-    } else if (command_marker == ADS_REGISTER_READ) {
-        uchar ch = ads_read_reg(command[4]);
-        uart_flush(); // ждем завершения отправки по uart
-        uart_transmit(&ch, 1);
-    }
-        /************** MACRO COMMANDS *******************/
-    else if (command_marker == ADS_START_RECORDING) {
-        uchar number_of_signals = ads_number_of_signals();
-        for (int i = 0; i < number_of_signals; ++i) {
-            ads_dividers[i] = command[4 + i];
+static void ads_recording_stop(uchar *command) {
+    if (!ads_stop_recording()) {
+        defer(command);
+        return;
+    }
+    adc_stop();
+}
+
+static void uart_baud_rate_set(uchar *command) {
+    uchar baud_rate = command[4];
+    // предпоследний байт содержит новую скорость
+    message_baud_rate[MSG_BAUD_RATE_SIZE - 2] = (baud_rate < UART_BAUD_RATES) ? baud_rate : 0xFF;
+    // сначала ответ на старой скорости, пока uart_set_baud_rate не запретил отправку
+    reply(message_baud_rate, MSG_BAUD_RATE_SIZE);
+    if (reply_size == 0) {
+        uart_set_baud_rate(baud_rate);
+    } else {
+        reply_baud_rate = baud_rate; // переключим когда ответ встанет в очередь
+    }
+}
+
+static void hello_request(uchar *command) {
+    (void)command;
+    reply(message_hello, MSG_HELLO_SIZE);
+}
+
+static void hardware_request(uchar *command) {
+    (void)command;
+    // предпоследний байт содержит информацию о числе каналов ADS (2 или 8)
+    message_hardware[MSG_HARDWARE_SIZE - 2] = ads_number_of_signals();
+    reply(message_hardware, MSG_HARDWARE_SIZE);
+}
+
+static void status_request(uchar *command) {
+    (void)command;
+    uint batch_overruns = databatch_overruns();
+    uint sample_overruns = ads_sample_overruns();
+    uint rx_dropped = uart_rx_dropped();
+    message_status[4] = (uchar)batch_overruns;
+    message_status[5] = (uchar)(batch_overruns >> 8);
+    message_status[6] = (uchar)sample_overruns;
+    message_status[7] = (uchar)(sample_overruns >> 8);
+    message_status[8] = (uchar)rx_dropped;
+    message_status[9] = (uchar)(rx_dropped >> 8);
+    message_status[10] = (uchar)commands_dropped;
+    message_status[11] = (uchar)(commands_dropped >> 8);
+    reply(message_status, MSG_STATUS_SIZE);
+}
+
+static void ping(uchar *command) {
+    (void)command;
+    reply(message_ping, MSG_PING_SIZE);
+}
+
+static void do_command(uchar *command, uchar size);
+
+static pending_command* pending_find(bool tagged, uchar id) {
+    for (uchar i = 0; i < PENDING_COMMANDS; i++) {
+        pending_command* pending = &pending_commands[i];
+        if (pending->command != 0 && pending->tagged == tagged && (!tagged || pending->id == id)) {
+            return pending;
+        }
+    }
+    return 0;
+}
+
+static bool buffer_pending(uchar* buffer) {
+    if (buffer == deferred_command) {
+        return true;
+    }
+    for (uchar i = 0; i < PENDING_COMMANDS; i++) {
+        if (pending_commands[i].command == buffer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Буфер для приема следующей команды: не занятый ждущей подтверждения (или отложенной) командой
+ * и не стоящий в очереди на отправку (эхо). 0 если такого нет - тогда принятые байты ждут в fifo,
+ * пока эхо не отправится (EVENT_UART_TX), а если fifo почти полон - разбираются в drain_buffer и отбрасываются
+ */
+static uchar* free_buffer() {
+    for (uchar i = 0; i <= PENDING_COMMANDS; i++) {
+        uchar* candidate = command_buffers[i];
+        if (!buffer_pending(candidate) && !uart_transmit_pending(candidate)
+            && !(reply_size != 0 && reply_data == candidate)) {
+            return candidate;
         }
-        databatch_start(ads_dividers);
-        ads_start_recording();
-    } else if (command_marker == ADS_STOP_RECORDING) {
-        ads_stop_recording();
-    } else if (command_marker == HELLO_REQUEST) {
-        uart_flush(); // ждем завершения отправки по uart
-        uart_transmit(message_hello, MSG_HELLO_SIZE);
-    } else if (command_marker == HARDWARE_REQUEST) {
-        // предпоследний байт содержит информацию о числе каналов ADS (2 или 8)
-        message_hardware[MSG_HARDWARE_SIZE - 2] = ads_number_of_signals();
-        uart_flush(); // ждем завершения отправки по uart
-        uart_transmit(message_hardware, MSG_HARDWARE_SIZE);
-    } else if (command_marker == COMMAND_CONFIRMED) {
-        if (command_buffered) {
-            command_buffered = false;
-            do_command(command_buffer);
+    }
+    return 0;
+}
+
+/**
+ * Ставит принятую команду (fill_buffer) в таблицу ждущих подтверждения
+ * @return false если таблица полна (хосту уходит MESSAGE_REJECTED_MARKER)
+ */
+static bool pending_store(bool tagged, uchar id) {
+    pending_command* pending = pending_find(tagged, id); // повтор команды с тем же id заменяет прежнюю
+    for (uchar i = 0; pending == 0 && i < PENDING_COMMANDS; i++) {
+        if (pending_commands[i].command == 0) {
+            pending = &pending_commands[i];
         }
     }
+    if (pending == 0) {
+        reject(fill_buffer[3], id);
+        return false;
+    }
+    pending->command = fill_buffer;
+    pending->tagged = tagged;
+    pending->id = id;
+    return true;
+}
+
+static void command_confirmed(uchar *command) {
+    bool tagged = (command_size == 7);
+    pending_command* pending = pending_find(tagged, command[4]);
+    if (pending != 0) {
+        uchar* confirmed = pending->command;
+        pending->command = 0;
+        // без sequence_id команда выглядит для обработчика как обычная
+        do_command(confirmed, tagged ? confirmed[2] - 1 : confirmed[2]);
+    }
+}
+
+/**
+ * Таблица команд, индекс - (COMMAND_MARKER - COMMAND_MARKER_BASE).
+ * Для каждой команды: обработчик, допустимый размер фрейма (проверяется как только пришел маркер)
+ * и нужно ли подтверждение. Пустая запись (handler == 0) - такой команды нет.
+ */
+#define COMMAND_MARKER_BASE 0xA0
+#define COMMAND_TABLE_SIZE 32 // маркеры 0xA0 - 0xBF
+
+typedef enum {
+    CONFIRM_OPTIONAL, // команда может идти как с подтверждением, так и без
+    CONFIRM_REQUIRED, // команда выполняется только после подтверждения
+    CONFIRM_NEVER     // команда всегда выполняется сразу
+} CONFIRM_POLICY;
+
+typedef struct {
+    void (*handler)(uchar *command);
+    uchar min_length; // размер фрейма (frame size)
+    uchar max_length;
+    CONFIRM_POLICY confirm;
+} command_descriptor;
+
+#define COMMAND(marker) [(marker) - COMMAND_MARKER_BASE]
+// ADS_START_RECORDING: делители, затем необязательные байты опций, длины записи и периода ADC
+#define START_RECORDING_LENGTH (ADS_NUMBER_OF_CHANNELS + 6)
+
+static const command_descriptor command_table[COMMAND_TABLE_SIZE] = {
+    COMMAND(PROCESSOR_REGISTER_WRITE)      = {processor_register_write, 9, 9, CONFIRM_OPTIONAL},
+    COMMAND(PROCESSOR_REGISTER_SET_BITS)   = {processor_register_set_bits, 9, 9, CONFIRM_OPTIONAL},
+    COMMAND(PROCESSOR_REGISTER_CLEAR_BITS) = {processor_register_clear_bits, 9, 9, CONFIRM_OPTIONAL},
+    COMMAND(PROCESSOR_REGISTER_READ)       = {processor_register_read, 8, 8, CONFIRM_OPTIONAL},
+    COMMAND(ADS_REGISTER_WRITE)            = {ads_register_write, 8, 8, CONFIRM_OPTIONAL},
+    COMMAND(ADS_REGISTER_READ)             = {ads_register_read, 7, 7, CONFIRM_OPTIONAL},
+    COMMAND(ADS_START_RECORDING)           = {ads_recording_start, START_RECORDING_LENGTH, START_RECORDING_LENGTH + 4, CONFIRM_OPTIONAL},
+    COMMAND(ADS_STOP_RECORDING)            = {ads_recording_stop, 6, 6, CONFIRM_OPTIONAL},
+    COMMAND(HELLO_REQUEST)                 = {hello_request, 6, 6, CONFIRM_OPTIONAL},
+    COMMAND(HARDWARE_REQUEST)              = {hardware_request, 6, 6, CONFIRM_OPTIONAL},
+    COMMAND(PING)                          = {ping, 6, 6, CONFIRM_OPTIONAL},
+    COMMAND(COMMAND_CONFIRMED)             = {command_confirmed, 6, 7, CONFIRM_NEVER},
+    COMMAND(UART_BAUD_RATE_SET)            = {uart_baud_rate_set, 7, 7, CONFIRM_REQUIRED},
+    COMMAND(ADS_REGISTERS_WRITE)           = {ads_registers_write, 8, ADS_NUMBER_OF_REGISTERS + 7, CONFIRM_OPTIONAL},
+    COMMAND(ADS_REGISTERS_READ)            = {ads_registers_read, 8, 8, CONFIRM_OPTIONAL},
+    COMMAND(PROCESSOR_MEMORY_WRITE)        = {processor_memory_write, 9, MAX_COMMAND_LENGTH - 1, CONFIRM_OPTIONAL},
+    COMMAND(PROCESSOR_MEMORY_READ)         = {processor_memory_read, 9, 9, CONFIRM_OPTIONAL},
+    COMMAND(STATUS_REQUEST)                = {status_request, 6, 6, CONFIRM_OPTIONAL},
+};
+
+/**
+ * Описание команды или 0 если такой команды нет или размер фрейма не подходит.
+ * Фрейм может оказаться на байт длиннее из-за sequence_id - это выясняется только по
+ * его концу, тогда размер проверяется еще раз в command_length_valid
+ */
+static const command_descriptor* command_lookup(uchar marker, uchar length) {
+    uchar index = marker - COMMAND_MARKER_BASE;
+    if (index >= COMMAND_TABLE_SIZE) {
+        return 0;
+    }
+    const command_descriptor* descriptor = &command_table[index];
+    if (descriptor->handler == 0 || length < descriptor->min_length || length > descriptor->max_length + 1) {
+        return 0;
+    }
+    return descriptor;
+}
+
+static bool command_length_valid(const command_descriptor* descriptor, uchar length) {
+    return length >= descriptor->min_length && length <= descriptor->max_length;
+}
+
+static const command_descriptor* fill_command; // описание принимаемой команды (по маркеру)
+
+/**
+ * Ставит принятую команду (fill_buffer) в таблицу ждущих подтверждения
+ * @param confirm предпоследний байт фрейма
+ * @return false если команда отброшена
+ */
+static bool command_store(const command_descriptor* descriptor, uchar confirm) {
+    if (descriptor->confirm == CONFIRM_NEVER) {
+        return false;
+    }
+    if (confirm == COMMAND_NEED_CONFIRM) {
+        return command_length_valid(descriptor, command_length) && pending_store(false, 0);
+    }
+    if (confirm == COMMAND_NEED_CONFIRM_TAGGED) { // sequence_id перед COMMAND_NEED_CONFIRM_TAGGED
+        return command_length_valid(descriptor, command_length - 1) && pending_store(true, fill_buffer[command_length - 3]);
+    }
+    return false;
+}
+
+static void do_command(uchar *command, uchar size) {
+    command_size = size;
+    command_table[command[3] - COMMAND_MARKER_BASE].handler(command);
 }
 
 void commands_process() {
-    uchar ch;
-    while(uart_read(&ch)) { // читаем символы из uart
-        if (fill_buffer_index == 0 && ch == FRAME_START) {
-            fill_buffer[fill_buffer_index++] = ch;
-        } else if (fill_buffer_index == 1 && ch == COMMAND_START) {
-            fill_buffer[fill_buffer_index++] = ch;
-        } else if (fill_buffer_index == 2 && ch < MAX_COMMAND_LENGTH) {
-            fill_buffer[fill_buffer_index++] = ch;
-            command_length = ch;
-        } else if (fill_buffer_index > 2 && fill_buffer_index < (command_length - 1)) {
-            fill_buffer[fill_buffer_index++] = ch;
-        } else if ((fill_buffer_index == (command_length - 1)) && (ch == FRAME_STOP)) {
-            fill_buffer[fill_buffer_index] = ch;
-            // проверяем предпоследний байт
-            if (fill_buffer[fill_buffer_index - 1] == FRAME_STOP) { // команда не требует подтверждения
-                do_command(fill_buffer);
-                fill_buffer_index = 0;
-            } else if (fill_buffer[fill_buffer_index - 1] == COMMAND_NEED_CONFIRM) { // комманда требует подтверждения
-                //swap double buffers
-                uchar *tmp = command_buffer;
-                command_buffer = fill_buffer;
-                fill_buffer = tmp;
-                uart_flush(); // ждем завершения отправки по uart
-                // отправляем комманду назад на проверку
-                uart_transmit(command_buffer, command_length);
-                //выставляем флаг
-                command_buffered = true;
-                fill_buffer_index = 0;
-            } else {
-                fill_buffer_index = 0; //invalid command
+    uchar* data;
+    uint size;
+    uart_baud_rate_process(); // переключаем скорость UART когда ответ на UART_BAUD_RATE_SET отправлен
+    replies_send();
+    if (deferred_command != 0 && reply_size == 0) { // повторяем команду, не вставшую в очередь ADS
+        uchar* command = deferred_command;
+        deferred_command = 0;
+        do_command(command, deferred_size);
+    }
+    if (fill_buffer == 0) { // ждем, пока освободится буфер для приема команды
+        fill_buffer = free_buffer();
+    }
+    bool waiting = replies_waiting();
+    bool draining = fifo_draining(waiting);
+    // разбираем принятые байты прямо в памяти fifo буфера UART (uart_read_span), кусками:
+    // заголовок и конец фрейма проверяются на месте, тело фрейма копируется в fill_buffer одним memcpy
+    // на кусок (команда живет дольше fifo: ждет подтверждения, уходит эхом).
+    // За один проход - не больше COMMAND_BYTES_PER_PASS байт и не больше одной команды,
+    // остальное в следующих проходах (состояние разбора статическое), чтобы не задерживать путь данных.
+    // Пока ответ не отправлен (например чтение регистров ADS), следующие команды ждут в fifo
+    // (иначе новое чтение затрет ads_register_values, а ответы пойдут не по порядку).
+    // Но ждать (и после команды прохода, и из-за ответов) можно только пока в fifo есть место:
+    // дальше команды разбираются сверх COMMAND_BYTES_PER_PASS и отбрасываются (fifo_draining)
+    uint budget = COMMAND_BYTES_PER_PASS;
+    bool command_done = false; // команда прохода выполнена: следующие ждут, как при replies_waiting
+    while ((budget > 0 || draining) && (!waiting || draining) && (size = uart_read_span(&data)) > 0) {
+        if (size > budget && !draining) {
+            size = budget;
+        }
+        uint i;
+        for (i = 0; i < size && (!waiting || draining); i++) {
+            uchar ch = data[i];
+            if (fill_buffer == 0) { // свободного буфера нет, а ждать нельзя
+                fill_buffer = drain_buffer;
             }
-        } else {
-          /********send broken command back for debug purpose**********/
-            uchar *tmp = command_buffer;
-            command_buffer = fill_buffer;
-            fill_buffer = tmp;
-            uart_flush(); // ждем завершения отправки по uart
-            if(fill_buffer_index == 0) {
-              uart_transmit(&ch, 1); // send back received char
-              LED1_ON();
+            if (fill_buffer_index == 0 && ch == FRAME_START) {
+                fill_buffer[fill_buffer_index++] = ch;
+            } else if (fill_buffer_index == 1 && ch == COMMAND_START) {
+                fill_buffer[fill_buffer_index++] = ch;
+            } else if (fill_buffer_index == 2 && ch < MAX_COMMAND_LENGTH) {
+                fill_buffer[fill_buffer_index++] = ch;
+                command_length = ch;
+            } else if (fill_buffer_index == 3 && (fill_command = command_lookup(ch, command_length)) != 0) {
+                fill_buffer[fill_buffer_index++] = ch; // маркер известен и размер фрейма ему подходит
+            } else if (fill_buffer_index > 3 && fill_buffer_index < (command_length - 1)) {
+                // тело фрейма до предпоследнего байта или до конца куска
+                uint body_size = (command_length - 1) - fill_buffer_index;
+                if (body_size > size - i) {
+                    body_size = size - i;
+                }
+                memcpy(&fill_buffer[fill_buffer_index], &data[i], body_size);
+                fill_buffer_index += body_size;
+                i += body_size - 1;
+            } else if (fill_buffer_index > 3 && (fill_buffer_index == (command_length - 1)) && (ch == FRAME_STOP)) {
+                // сюда попадаем только после маркера, найденного command_lookup (fill_command != 0),
+                // неизвестный маркер или неподходящий размер - сразу broken command ниже
+                fill_buffer[fill_buffer_index] = ch;
+                // проверяем предпоследний байт
+                uchar confirm = fill_buffer[fill_buffer_index - 1];
+                if (waiting) { // разобрана в режиме fifo_draining
+                    command_drop(fill_buffer[3], confirm == COMMAND_NEED_CONFIRM_TAGGED ? fill_buffer[command_length - 3] : 0);
+                    if (fill_buffer == drain_buffer) {
+                        fill_buffer = free_buffer();
+                    }
+                } else if (confirm == FRAME_STOP && fill_command->confirm != CONFIRM_REQUIRED
+                    && command_length_valid(fill_command, command_length)) { // команда без подтверждения
+                    do_command(fill_buffer, command_length);
+                } else if (command_store(fill_command, confirm)) { // комманда требует подтверждения
+                    // отправляем комманду назад на проверку (из ее буфера без копирования),
+                    // а принимать следующую будем в свободный буфер
+                    reply(fill_buffer, command_length);
+                    fill_buffer = free_buffer();
+                }
+                if (!waiting) {
+                    command_done = true;
+                    waiting = true;
+                    draining = fifo_draining(waiting);
+                }
+                fill_buffer_index = 0; // иначе invalid command
             } else {
-              // send back received "broken command"
-              uart_transmit(command_buffer, (fill_buffer_index+1)); 
-            }
-             LED3_ON();
-            /********************************************************/
+              /********send broken command back for debug purpose**********/
+                if (waiting) {
+                  // в режиме fifo_draining эхо не отправляется, байты просто отбрасываются
+                  if (fill_buffer == drain_buffer) {
+                    fill_buffer = free_buffer();
+                  }
+                } else if(fill_buffer_index == 0) {
+                  broken_char = ch;
+                  reply(&broken_char, 1); // send back received char
+                  waiting = replies_waiting(); // следующий байт - только когда broken_char отправлен
+                  draining = fifo_draining(waiting);
+                  LED1_ON();
+                } else {
+                  // send back received "broken command"
+                  fill_buffer[fill_buffer_index] = ch;
+                  reply(fill_buffer, (fill_buffer_index+1));
+                  fill_buffer = free_buffer();
+                  waiting = replies_waiting(); // следующий байт - только в свободный буфер
+                  draining = fifo_draining(waiting);
+                }
+                 LED3_ON();
+                /********************************************************/
             
-             fill_buffer_index = 0; //invalid command
+                 fill_buffer_index = 0; //invalid command
+            }
+        }
+        uart_read_commit(i);
+        budget = (i < budget) ? budget - i : 0;
+        // в режиме fifo_draining состояние проверяется раз на кусок, а не на каждый фрейм:
+        // разбор должен успевать за приемом
+        if (waiting && !command_done) {
+            waiting = replies_waiting(); // ответы могли уйти
         }
+        draining = fifo_draining(waiting); // место в fifo освободилось
+    }
+    if ((command_done || !waiting || draining) && uart_read_span(&data) > 0) {
+        EVENT_SET(EVENT_UART_RX); // в fifo остались байты - продолжим в следующем проходе
     }
 }
-
-
-
@@ -1,4 +1,4 @@
-#include "msp430f2274.h"
+#include "hal.h"
 
 void stop_watchdog(){
 // Stop watchdog timer to prevent time out reset
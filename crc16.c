@@ -0,0 +1,32 @@
+#include "utypes.h"
+#include "crc16.h"
+
+/**
+ * CRC-16/CCITT-FALSE: полином 0x1021, начальное значение 0xFFFF (CRC16_INIT), без инверсии.
+ * Считаем по полубайтам (nibble): таблица всего 16 слов (32 байта flash)
+ * вместо 256 слов для побайтовой таблицы.
+ * Значимы только младшие 16 бит результата (на хосте uint шире 16 бит)
+ */
+static const uint crc_table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+uint crc16_update(uint crc, uchar byte) {
+    crc = (crc << 4) ^ crc_table[((crc >> 12) ^ (byte >> 4)) & 0x0F];
+    crc = (crc << 4) ^ crc_table[((crc >> 12) ^ byte) & 0x0F];
+    return crc;
+}
+
+// 16-битное слово, младший байт первым (Little Endian)
+uint crc16_update_word(uint crc, uint word) {
+    crc = crc16_update(crc, (uchar)word);
+    return crc16_update(crc, (uchar)(word >> 8));
+}
+
+uint crc16_update_block(uint crc, uchar* data, uint data_size) {
+    while (data_size-- > 0) {
+        crc = crc16_update(crc, *data++);
+    }
+    return crc;
+}
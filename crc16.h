@@ -0,0 +1,12 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+#include "utypes.h"
+
+#define CRC16_INIT 0xFFFF
+
+uint crc16_update(uint crc, uchar byte);
+uint crc16_update_word(uint crc, uint word);
+uint crc16_update_block(uint crc, uchar* data, uint data_size);
+
+#endif //CRC16_H
@@ -4,13 +4,24 @@
 #include "utypes.h"
 #include "uart_spi.h"
 #include "leds.h"
+#include "rice.h"
+#include "crc16.h"
+#include "databatch.h"
+#include "batch_layout.h"
 
 #define START_MARKER 0xAA
 #define STOP_MARKER 0x55
+// второй байт фрейма: FRAME_MARKER | флаги фрейма
+#define FRAME_MARKER 0xA8
+#define FRAME_COMPRESSED 0x01 // сжатый фрейм
+#define FRAME_BATTERY 0x02 // во фрейме есть батарея
+#define COMPRESSED_MARKER (FRAME_MARKER | FRAME_BATTERY | FRAME_COMPRESSED) // 0xAB
 
 /**======================== Формат данных ======================
 
 START_MARKER|START_MARKER|счетчик фреймов(2bytes)|данные . . .|STOP_MARKER
+Второй байт - FRAME_MARKER с флагами: 0xAA (START_MARKER) - обычный фрейм с батареей,
+0xA8 - обычный фрейм без батареи, 0xAB (COMPRESSED_MARKER) и 0xA9 - то же для сжатых фреймов.
 
 Данные имеют следующий вид:
 n_0 samples from ads_channel_0 (if this ads channel enabled)
@@ -20,108 +31,455 @@ n_8 samples from ads_channel_8 (if this ads channel enabled)
 2 bytes from accelerometer_x channel
 2 bytes from accelerometer_y channel
 2 bytes from accelerometer_Z channel
-2 bytes with BatteryVoltage info (if BatteryVoltageMeasure  enabled)
+2 bytes with BatteryVoltage info (if FRAME_BATTERY flag is set)
+   (акселерометр - среднее всех измерений ADC за фрейм * 64, см. adc_get_data();
+   батарея измеряется раз в секунду (* 64) и передается только в тех фреймах где она изменилась,
+   но не реже раза в BATTERY_REPEAT_PERIOD измерений)
 1 byte(for 2 channels) or 2 bytes(for 8 channels) with lead-off detection info (if lead-off detection enabled)
+   (опция DATABATCH_LEAD_OFF: LOFF_STAT из слова статуса ADS, OR по всем измерениям фрейма,
+   т.е. бит выставлен если электрод отключался хотя бы раз за фрейм, см. ads_get_loff_status())
+2 bytes CRC-16 фрейма (см. ниже)
 
 Каждый sample данных занимает 3 байта.
 n_i = ads_channel_i_sampleRate * durationOfDataRecord
-durationOfDataRecord = sps/10 (sps частота оцифровки)
+durationOfDataRecord = record_length/sps (sps максимальная частота оцифровки ADS)
+n_i = record_length/divider_i (divider_i задается для каждого канала в databatch_start, 0 - канал выключен)
+record_length задается в databatch_start (по умолчанию 10), см. fit_record_length()
 последовательность байт Little Endian
+
+Сжатый фрейм (опция DATABATCH_COMPRESSED):
+START_MARKER|COMPRESSED_MARKER|счетчик фреймов(2bytes)|размер битового потока(2bytes)|k_0|...|k_N-1|битовый поток|...|STOP_MARKER
+k_i - параметр кода Райса канала i (по байту на каждый канал ADS, в том числе выключенный).
+Битовый поток содержит те же измерения ADS что и обычный фрейм, но в порядке их поступления:
+для каждого измерения ADS по очереди каналы которые сохраняют это измерение.
+Первое измерение каждого канала во фрейме записано целиком, остальные - как разности
+(формат битового потока описан в rice.c), поэтому каждый фрейм декодируется независимо.
+Дальше как в обычном фрейме: акселерометр, батарея, lead-off, CRC, STOP_MARKER.
+
+CRC фрейма (CRC-16/CCITT-FALSE, см. crc16.c) считается по ходу заполнения фрейма, без второго прохода:
+у каждой области данных ADS свой CRC (у обычного фрейма область - измерения одного канала,
+у сжатого - весь битовый поток), а CRC фрейма считается по байтам
+заголовка (все байты до данных ADS) | CRC области 0 (2 bytes) | CRC области 1 | ... | акселерометр | батарея | lead-off.
+Ошибка внутри области меняет CRC области, а значит и CRC фрейма.
  =========================================================**/
 
-#define ADS_BATCH_SIZE (10*6)  //The ADS's share in the total batch
-#define ADS_HALF_BATCH_SIZE ADS_BATCH_SIZE/2
-#define BATCH_HEADER_SIZE 4
+#define DEFAULT_RECORD_LENGTH 10 // число измерений ADS (на максимальной частоте) в одном фрейме по умолчанию
+#define MAX_RECORD_LENGTH 250 // record_counter и счетчики каналов однобайтовые
+#define ADS_BATCH_SIZE (DEFAULT_RECORD_LENGTH * ADS_SAMPLE_BYTES * ADS_NUMBER_OF_CHANNELS)  //The ADS's max share in the total batch (all dividers = 1)
+#define COMPRESSED_ADS_BATCH_SIZE ((DEFAULT_RECORD_LENGTH * ADS_NUMBER_OF_CHANNELS * RICE_MAX_BITS + 7) / 8) // худший случай
 
-//Total size of the whole batch (10 samples for two channels+accelerometer,
-// battery and a stop byte)
-#define MAX_BATCH_SIZE (BATCH_HEADER_SIZE + ADS_BATCH_SIZE + 9)
+//Total size of the whole batch (10 samples for every channel + the longest tail),
+// это бюджет RAM на один буфер очереди: более длинные фреймы допустимы
+// только если каналов включено меньше или они прорежены (см. fit_record_length()),
+// смещения полей заголовка и хвоста см. batch_layout.h
+#define RAW_BATCH_SIZE (BATCH_HEADER_SIZE + ADS_BATCH_SIZE + MAX_TAIL_SIZE)
+#define COMPRESSED_BATCH_SIZE (COMPRESSED_HEADER_SIZE + COMPRESSED_ADS_BATCH_SIZE + MAX_TAIL_SIZE)
+#define MAX_BATCH_SIZE (RAW_BATCH_SIZE > COMPRESSED_BATCH_SIZE ? RAW_BATCH_SIZE : COMPRESSED_BATCH_SIZE)
 
-static int batch_size;
-static uchar* ads_signal_dividers;
+static bool compressed; // фреймы сжимаются
+static uchar tail_config; // постоянная часть конфигурации хвоста (LAYOUT_LEAD_OFF), LAYOUT_BATTERY - пофреймово
+static uchar record_length = DEFAULT_RECORD_LENGTH; // число измерений ADS в одном фрейме
 
-/*******  double buffer for all signals: ADS, ADC and helper info ******/
-static uchar data_buffer_0[MAX_BATCH_SIZE];
-static uchar data_buffer_1[MAX_BATCH_SIZE];
-static uchar* fill_buffer = data_buffer_0; // ссылка на буфер для заполнения
-static uchar* display_buffer = data_buffer_1;  //ссылка на заполненный буфер готовый для обработки
+/**
+ * Очередь (кольцо) из BATCH_QUEUE_SIZE буферов для всех сигналов: ADS, ADC и служебной информации.
+ * queue_head - буфер который сейчас заполняется,
+ * queue_tail - самый старый готовый фрейм (отправляется или ждет отправки).
+ * Готовые фреймы лежат между queue_tail и queue_head и уходят в UART строго по порядку,
+ * в очереди UART всегда не больше одного фрейма: следующий ставится на отправку
+ * только когда предыдущий отправлен. Ответы на команды встают в очередь UART между фреймами.
+ * Если очередь полна, только что заполненный фрейм выбрасывается (буфер заполняется заново),
+ * но номер он все равно получает - хост видит пропуск в batch_counter.
+ * Все индексы меняются только в main loop, поэтому обычные (не volatile) переменные.
+ */
+#define BATCH_QUEUE_SIZE 3 // готовых фреймов в очереди может быть не больше BATCH_QUEUE_SIZE - 1
+static uchar batch_queue[BATCH_QUEUE_SIZE][MAX_BATCH_SIZE];
+static int batch_sizes[BATCH_QUEUE_SIZE]; // размер каждого готового фрейма (у сжатых он разный)
+static uchar queue_head = 0;
+static uchar queue_tail = 0;
+static bool batch_sending = false; // фрейм queue_tail отдан в UART
+static uchar* fill_buffer = batch_queue[0]; // ссылка на буфер для заполнения
+static unsigned int batch_overruns = 0; // сколько фреймов выброшено из-за переполнения очереди (STATUS_REQUEST)
 /***********************************************************************/
 
-//TODO сделать упаковщик универсальным и для 2 и для 8 каналов
+/**
+ * Раскладка фрейма строится в databatch_start() по делителям каналов.
+ * Канал с делителем d получает record_length/d измерений (берется каждое d-ое измерение).
+ * Делитель 0 означает что канал выключен и в фрейм не попадает.
+ * record_length всегда кратна делителям всех включенных каналов (см. fit_record_length()).
+ */
+static uchar channel_dividers[ADS_NUMBER_OF_CHANNELS];
+static uchar channel_counters[ADS_NUMBER_OF_CHANNELS]; // сколько измерений канала осталось до следующего сохраняемого
+static int channel_offsets[ADS_NUMBER_OF_CHANNELS]; // начало области канала во фрейме
+static uint channel_crcs[ADS_NUMBER_OF_CHANNELS]; // CRC уже записанных измерений канала
+static uchar* channel_pointers[ADS_NUMBER_OF_CHANNELS]; // куда будет записано следующее измерение канала
+/**
+ * Измерения ADS пишутся по SPI прямо во фрейм (см. ads_channel_slots()),
+ * уже в Little Endian. Измерения каналов которые не попадают во фрейм
+ * (прореживание или канал выключен) пишутся в discarded_sample
+ */
+static uchar** channel_slots;
+static uchar discarded_sample[ADS_SAMPLE_BYTES];
+
+/**
+ * Сжатие: сохраняемые измерения каналов пишутся по SPI в sample_buffers,
+ * откуда кодируются в битовый поток фрейма. Параметр k каждого канала
+ * подбирается по среднему остатку предыдущего фрейма
+ */
+#define RICE_DEFAULT_PARAMETER 8
+static uchar sample_buffers[ADS_NUMBER_OF_CHANNELS][ADS_SAMPLE_BYTES];
+static unsigned long previous_samples[ADS_NUMBER_OF_CHANNELS];
+static uchar rice_parameters[ADS_NUMBER_OF_CHANNELS];
+static unsigned long residual_sums[ADS_NUMBER_OF_CHANNELS];
+static uchar residual_counts[ADS_NUMBER_OF_CHANNELS];
+static uint payload_crc; // CRC уже записанной части битового потока
+static uchar* payload_crc_pointer; // до какого байта битового потока посчитан payload_crc
+
+static uint frame_crc; // CRC фрейма до хвоста (заголовок и CRC областей ADS)
+static uint lead_off; // lead-off статус всех измерений фрейма (OR)
+static uchar* adc_values; // средние ADC за фрейм, adc_get_data() вызывается один раз на фрейм
+
+#define BATTERY_REPEAT_PERIOD 10 // неизменное напряжение батареи повторяется раз в 10 измерений (секунд)
+static uint battery_reported; // последнее переданное напряжение батареи
+static uchar battery_repeat_counter;
 
 //Counters for frames of data (batches)
 static unsigned int batch_counter = 0;
-static int sample_pointer = 0;
+static uchar record_counter = 0; // сколько измерений ADS уже принято в текущий фрейм
 
-/*void set_batch_size(){
-    batch_size = ((10*3)/fr_divider[0]) + ((10*3)/fr_divider[1]) + 8 + 1;
-}*/
+static uchar next_in_queue(uchar index){
+    index++;
+    if (index == BATCH_QUEUE_SIZE) {
+        index = 0;
+    }
+    return index;
+}
+
+/**
+ * Упаковка полей хвоста. tail - начало хвоста, offset - смещение поля в хвосте
+ * (константа из batch_layout.h для выбранной конфигурации)
+ */
+static void pack_ACCELEROMETER(uchar* tail, uchar offset){
+    uchar* acc_data = adc_values;
+    //Adding acc data to the batch  По 2 байта на каждую из осей x, y ,z
+    tail[offset] = acc_data[6];
+    tail[offset + 1] = acc_data[7];
+    tail[offset + 2] = acc_data[4];
+    tail[offset + 3] = acc_data[5];
+    tail[offset + 4] = acc_data[2];
+    tail[offset + 5] = acc_data[3];
+}
+
+static void pack_BATTERY(uchar* tail, uchar offset){
+    uchar* acc_data = adc_values;
+    tail[offset] = acc_data[0];
+    tail[offset + 1] = acc_data[1];
+}
+
+static void pack_LEAD_OFF(uchar* tail, uchar offset){
+    tail[offset] = (uchar)lead_off;
+    if (ADS_LOFF_SIZE > 1) {
+        tail[offset + 1] = (uchar)(lead_off >> 8);
+    }
+}
+
+// CRC фрейма досчитываем по всем полям хвоста перед CRC
+static void pack_CRC(uchar* tail, uchar offset){
+    uint crc = crc16_update_block(frame_crc, tail, offset);
+    tail[offset] = (uchar)crc;
+    tail[offset + 1] = (uchar)(crc >> 8);
+}
+
+static void pack_STOP(uchar* tail, uchar offset){
+    tail[offset] = STOP_MARKER;
+}
+
+/**
+ * Для каждой конфигурации своя функция упаковки хвоста: поля которых нет в конфигурации
+ * отбрасываются компилятором, смещения - константы. Возвращает конец фрейма.
+ */
+#define PACK_TAIL_FIELD(config, name, size, option) \
+    if (LAYOUT_FIELD_SIZE(size, option, config) != 0) { pack_##name(tail, TAIL_##config##_##name); }
+#define DEFINE_PACK_TAIL(config) \
+    static uchar* pack_tail_##config(uchar* tail){ \
+        BATCH_TAIL_FIELDS(PACK_TAIL_FIELD, config) \
+        return tail + TAIL_##config##_SIZE; \
+    }
+
+DEFINE_PACK_TAIL(0)
+DEFINE_PACK_TAIL(1)
+DEFINE_PACK_TAIL(2)
+DEFINE_PACK_TAIL(3)
+
+static uchar* (* const pack_tails[LAYOUT_CONFIGS])(uchar* tail) = {
+    pack_tail_0, pack_tail_1, pack_tail_2, pack_tail_3
+};
+static const uchar tail_sizes[LAYOUT_CONFIGS] = {
+    TAIL_0_SIZE, TAIL_1_SIZE, TAIL_2_SIZE, TAIL_3_SIZE
+};
+
+static void set_channel_offsets(){
+    int offset = BATCH_HEADER_SIZE;
+    for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+        channel_offsets[i] = offset;
+        if (channel_dividers[i] != 0) {
+            offset += (record_length / channel_dividers[i]) * ADS_SAMPLE_BYTES;
+        }
+    }
+}
+
+// назначаем куда SPI положит следующее измерение каждого канала
+static void set_channel_slots(){
+    for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+        if (channel_counters[i] == 1) {
+            channel_slots[i] = compressed ? sample_buffers[i] : channel_pointers[i];
+        } else {
+            channel_slots[i] = discarded_sample;
+        }
+    }
+}
+
+// начинаем заполнять новый фрейм
+static void reset_record(){
+    for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+        // первое измерение фрейма сохраняется всегда, выключенный канал (0) не сохраняется никогда
+        channel_counters[i] = (channel_dividers[i] != 0);
+        channel_pointers[i] = fill_buffer + channel_offsets[i];
+        channel_crcs[i] = CRC16_INIT;
+    }
+    record_counter = 0;
+    lead_off = 0;
+    if (compressed) {
+        for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+            if (residual_counts[i] != 0) {
+                rice_parameters[i] = rice_parameter(residual_sums[i], residual_counts[i]);
+            }
+            residual_sums[i] = 0;
+            residual_counts[i] = 0;
+            fill_buffer[COMPRESSED_RICE_PARAMETERS + i] = rice_parameters[i];
+        }
+        payload_crc = CRC16_INIT;
+        payload_crc_pointer = fill_buffer + COMPRESSED_HEADER_SIZE;
+        rice_begin(payload_crc_pointer);
+    }
+}
 
-static void set_batch_size(){
-    batch_size = BATCH_HEADER_SIZE + 10*3 + 10*3 + 8 + 1;
+// досчитываем CRC битового потока по байтам записанным с прошлого раза
+static void update_payload_crc(){
+    uchar* position = rice_position();
+    payload_crc = crc16_update_block(payload_crc, payload_crc_pointer, position - payload_crc_pointer);
+    payload_crc_pointer = position;
+}
+
+static void compress_sample(uchar channel){
+    uchar* sample_bytes = sample_buffers[channel];
+    unsigned long sample = ((unsigned long)sample_bytes[2] << 16) | ((uint)sample_bytes[1] << 8) | sample_bytes[0];
+    if (record_counter == 0) { // первое измерение канала во фрейме
+        rice_put_raw(sample);
+    } else {
+        residual_sums[channel] += rice_put_delta(sample, previous_samples[channel], rice_parameters[channel]);
+        residual_counts[channel]++;
+    }
+    previous_samples[channel] = sample;
+}
+
+// батарея попадает во фрейм только если пришло новое измерение и оно изменилось или давно не передавалось
+static bool battery_due(){
+    if (!adc_battery_updated()) {
+        return false;
+    }
+    uint battery = adc_values[0] | ((uint)adc_values[1] << 8);
+    if (battery != battery_reported || ++battery_repeat_counter >= BATTERY_REPEAT_PERIOD) {
+        battery_reported = battery;
+        battery_repeat_counter = 0;
+        return true;
+    }
+    return false;
 }
 
 static void make_batch(){
-    uchar* acc_data = adc_get_data();
-    //Adding acc data to the batch  По 2 байта на каждую из осей x, y ,z
-    //Adding acc data to the batch
-    fill_buffer[batch_size - 9] = acc_data[6];
-    fill_buffer[batch_size - 8] = acc_data[7];
-    fill_buffer[batch_size - 7] = acc_data[4];
-    fill_buffer[batch_size - 6] = acc_data[5];
-    fill_buffer[batch_size - 5] = acc_data[2];
-    fill_buffer[batch_size - 4] = acc_data[3];
-    //Adding battery info
-    fill_buffer[batch_size - 3] = acc_data[0];
-    fill_buffer[batch_size - 2] = acc_data[1];
-    //Stop marker
-    fill_buffer[batch_size - 1] = STOP_MARKER;
+    uchar* tail; // начало хвоста фрейма (акселерометр, батарея, lead-off, CRC, стоп маркер)
+    uchar config = tail_config;
+    uchar marker = FRAME_MARKER;
+    adc_values = adc_get_data();
+    if (battery_due()) {
+        config |= LAYOUT_BATTERY;
+        marker |= FRAME_BATTERY;
+    }
     //Writing header info
-    fill_buffer[0] = START_MARKER;
-    fill_buffer[1] = START_MARKER;
+    fill_buffer[HEADER_START] = START_MARKER;
     //Assigning  batch a number
-    fill_buffer[2] = (uchar)batch_counter;
-    fill_buffer[3] = (uchar)(batch_counter >> 8);
+    fill_buffer[HEADER_COUNTER] = (uchar)batch_counter;
+    fill_buffer[HEADER_COUNTER + 1] = (uchar)(batch_counter >> 8);
+    // CRC фрейма: заголовок и CRC областей ADS, хвост досчитывает pack_CRC
+    frame_crc = CRC16_INIT;
+    if (compressed) {
+        tail = rice_end();
+        update_payload_crc();
+        uint payload_size = tail - (fill_buffer + COMPRESSED_HEADER_SIZE);
+        fill_buffer[COMPRESSED_PAYLOAD_SIZE] = (uchar)payload_size;
+        fill_buffer[COMPRESSED_PAYLOAD_SIZE + 1] = (uchar)(payload_size >> 8);
+        fill_buffer[HEADER_MARKER] = marker | FRAME_COMPRESSED;
+        frame_crc = crc16_update_block(frame_crc, fill_buffer, COMPRESSED_HEADER_SIZE);
+        frame_crc = crc16_update_word(frame_crc, payload_crc);
+    } else {
+        tail = channel_pointers[ADS_NUMBER_OF_CHANNELS - 1]; // область последнего канала заполнена
+        fill_buffer[HEADER_MARKER] = marker;
+        frame_crc = crc16_update_block(frame_crc, fill_buffer, BATCH_HEADER_SIZE);
+        for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+            if (channel_dividers[i] != 0) {
+                frame_crc = crc16_update_word(frame_crc, channel_crcs[i]);
+            }
+        }
+    }
+    batch_sizes[queue_head] = pack_tails[config](tail) - fill_buffer;
     //Increasing the batch no int (two bytes)
     batch_counter++;
-    // swap double buffers
-    uchar *tmp = display_buffer;
-    display_buffer = fill_buffer;
-    fill_buffer = tmp;
-    //send data to uart
-    uart_transmit(display_buffer, batch_size);
+    // ставим фрейм в очередь на отправку
+    uchar next_head = next_in_queue(queue_head);
+    if (next_head == queue_tail) { // очередь полна, фрейм выбрасываем
+        batch_overruns++;
+    } else {
+        queue_head = next_head;
+        fill_buffer = batch_queue[queue_head];
+    }
+}
+
+// отправляем готовые фреймы по одному, следующий только после того как отправлен предыдущий
+static void send_batches(){
+    if (batch_sending) {
+        if (uart_transmit_pending(batch_queue[queue_tail])) {
+            return;
+        }
+        // фрейм queue_tail отправлен, освобождаем буфер
+        batch_sending = false;
+        queue_tail = next_in_queue(queue_tail);
+    }
+    if (queue_tail != queue_head && uart_transmit(batch_queue[queue_tail], batch_sizes[queue_tail])) {
+        batch_sending = true;
+    }
 }
 
 
-static void process_ads_samples(uchar* ads_sample){
-    signed char counter;
-    uchar* ads_buffer = fill_buffer + BATCH_HEADER_SIZE;
-    //Reading 1st channel (3 bytes). меняем порядок байт ?
-    for(counter = 2; counter >= 0; counter--){
-        ads_buffer[counter + sample_pointer] = *ads_sample++;
+// очередное измерение уже лежит в слотах, сдвигаем указатели каналов
+static void process_ads_samples(){
+    for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+        if (channel_dividers[i] != 0 && --channel_counters[i] == 0) {
+            channel_counters[i] = channel_dividers[i];
+            if (compressed) {
+                compress_sample(i);
+            } else {
+                channel_crcs[i] = crc16_update_block(channel_crcs[i], channel_pointers[i], ADS_SAMPLE_BYTES);
+                channel_pointers[i] += ADS_SAMPLE_BYTES;
+            }
+        }
+    }
+    if (compressed) {
+        update_payload_crc();
     }
-    //Reading 2nd channel (3 bytes)
-    for(counter = 2; counter >= 0; counter--){
-        ads_buffer[counter + sample_pointer + ADS_HALF_BATCH_SIZE] = *ads_sample++;
+    if (tail_config & LAYOUT_LEAD_OFF) {
+        lead_off |= ads_get_loff_status();
     }
-    sample_pointer += 3; //Pointing at the place to write the next byte
     //If all the ADS data is written, move on
-    if(sample_pointer >= ADS_HALF_BATCH_SIZE){
-        sample_pointer = 0;  
-        make_batch(); 
-    }    
+    if(++record_counter >= record_length){
+        make_batch();
+        reset_record();
+    }
+    set_channel_slots();
 }
 
-void databatch_start(uchar* ads_dividers) {
-    batch_counter = 0;//Setting the next batch number to zero
-    set_batch_size();
-    ads_signal_dividers = ads_dividers;
+// размер фрейма с length измерениями ADS в худшем случае (для сжатого - все измерения с escape)
+static int max_frame_size(uint length){
+    int size = tail_sizes[tail_config | LAYOUT_BATTERY];
+    unsigned long bits = 0;
+    for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+        if (channel_dividers[i] != 0) {
+            uint samples = length / channel_dividers[i];
+            size += samples * ADS_SAMPLE_BYTES;
+            bits += (unsigned long)samples * RICE_MAX_BITS;
+        }
+    }
+    if (compressed) {
+        return COMPRESSED_HEADER_SIZE + (int)((bits + 7) / 8) + tail_sizes[tail_config | LAYOUT_BATTERY];
+    }
+    return BATCH_HEADER_SIZE + size;
+}
+
+/**
+ * Подбираем длину записи (число измерений ADS во фрейме) ближайшую к запрошенной:
+ * она должна быть кратна делителям всех включенных каналов (НОК) и фрейм должен
+ * поместиться в буфер очереди (MAX_BATCH_SIZE). Канал, с которым это невозможно, выключается.
+ * Считается один раз при старте записи, поэтому умножения и деления здесь допустимы.
+ */
+static uchar fit_record_length(uchar requested){
+    uint step = 1; // НОК делителей включенных каналов
+    for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+        uchar divider = channel_dividers[i];
+        if (divider == 0) {
+            continue;
+        }
+        uint multiple = step;
+        while (multiple % divider != 0) {
+            multiple += step;
+        }
+        if (multiple > MAX_RECORD_LENGTH || max_frame_size(multiple) > MAX_BATCH_SIZE) {
+            channel_dividers[i] = 0; // канал выключен
+        } else {
+            step = multiple;
+        }
+    }
+    if (requested == 0) {
+        requested = DEFAULT_RECORD_LENGTH;
+    }
+    uint length = ((requested + step - 1) / step) * step; // округляем вверх до кратной
+    while (length > step && (length > MAX_RECORD_LENGTH || max_frame_size(length) > MAX_BATCH_SIZE)) {
+        length -= step;
+    }
+    return (uchar)length;
+}
+
+/**
+ * @return сколько фреймов текущей записи выброшено из-за переполнения очереди
+ * (хост видит их и как пропуски batch_counter)
+ */
+uint databatch_overruns() {
+    return batch_overruns;
 }
 
+uchar databatch_start(uchar* ads_dividers, uchar options, uchar requested_length) {
+    batch_counter = 0;//Setting the next batch number to zero
+    batch_overruns = 0;
+    // фреймы старой записи которые еще не ушли в UART выбрасываем
+    // (фрейм queue_tail возможно уже отправляется, поэтому его буфер не трогаем)
+    queue_head = queue_tail;
+    if (batch_sending) {
+        queue_head = next_in_queue(queue_tail);
+    }
+    fill_buffer = batch_queue[queue_head];
+    for (uchar i = 0; i < ADS_NUMBER_OF_CHANNELS; i++) {
+        channel_dividers[i] = ads_dividers[i];
+        rice_parameters[i] = RICE_DEFAULT_PARAMETER;
+        residual_counts[i] = 0;
+    }
+    compressed = (options & DATABATCH_COMPRESSED) != 0;
+    tail_config = 0; // батарея добавляется в make_batch() по мере измерения
+    battery_reported = 0xFFFF; // первое измерение батареи передается всегда
+    battery_repeat_counter = 0;
+    if (options & DATABATCH_LEAD_OFF) {
+        tail_config |= LAYOUT_LEAD_OFF;
+    }
+    record_length = fit_record_length(requested_length);
+    set_channel_offsets();
+    channel_slots = ads_channel_slots();
+    reset_record();
+    set_channel_slots();
+    return record_length;
+}
 
 void databatch_process() {
-    if(ads_data_received()) {
-        process_ads_samples(ads_get_data());
+    // забираем все готовые измерения: событие EVENT_ADS_DATA одно на несколько измерений
+    while (ads_data_received()) {
+        process_ads_samples();
     }
+    send_batches();
 }
 
@@ -1,7 +1,16 @@
 #ifndef DATABATCH_H
 #define DATABATCH_H
 
-void databatch_start(uchar* ads_dividers);
+// опции записи (битовая маска) для databatch_start
+#define DATABATCH_COMPRESSED 0x01 // измерения ADS сжимаются: разности + код Райса
+#define DATABATCH_LEAD_OFF 0x02 // в хвосте фрейма передается lead-off статус ADS
+
+/**
+ * requested_length - число измерений ADS в одном фрейме (0 - по умолчанию, 10).
+ * Возвращает принятую длину: она кратна делителям каналов и ограничена размером буфера фрейма.
+ */
+uchar databatch_start(uchar* ads_dividers, uchar options, uchar requested_length);
 void databatch_process();
+uint databatch_overruns();
 
 #endif //DATABATCH_H
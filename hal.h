@@ -0,0 +1,53 @@
+#ifndef HAL_H
+#define HAL_H
+
+/**
+ * Тонкий слой абстракции железа. Прошивка собирается либо для MSP430 (IAR),
+ * либо (MSP430_HOST) обычным компилятором в цель msp430_host, где регистры - переменные,
+ * а периферию моделирует host/hal_host.c.
+ * Обычные регистры читаются и пишутся напрямую, через HAL идет только то, что на хосте
+ * требует модели: векторы прерываний, регистры с побочным эффектом доступа (буферы USCI, TBIV, TBR),
+ * опрос флагов в циклах ожидания и адреса памяти (16 бит на MSP430).
+ */
+#include "msp430f2274.h"
+#include "intrinsics.h"
+
+#ifndef MSP430_HOST
+
+#define HAL_PRAGMA(x) _Pragma(#x)
+// обработчик прерывания: HAL_ISR(PORT1_VECTOR, PORT1_ISR) { ... }
+#define HAL_ISR(vector_number, name) HAL_PRAGMA(vector = vector_number) __interrupt void name(void)
+
+#define HAL_REGISTER_READ(reg) (reg)
+#define HAL_REGISTER_WRITE(reg, value) ((reg) = (value))
+#define HAL_POLL() // в цикле ожидания флага периферия работает сама
+
+#define HAL_ADDRESS(pointer) ((unsigned int)(pointer)) // адрес для регистров DTC и т.п.
+#define HAL_MEMORY(address) ((unsigned char*)(address)) // память по адресу MSP430
+
+#else
+
+void hal_host_isr_register(unsigned int vector, void (*isr)(void));
+unsigned int hal_host_register_read(const volatile void* reg);
+void hal_host_register_write(volatile void* reg, unsigned int value);
+void hal_host_poll();
+unsigned int hal_host_address(void* pointer);
+unsigned char* hal_host_memory(unsigned int address);
+void __low_power_mode_off_on_exit(void);
+
+// обработчик регистрируется в таблице векторов модели до main()
+#define HAL_ISR(vector_number, name) \
+    void name(void); \
+    static void __attribute__((constructor)) name##_register(void) { hal_host_isr_register(vector_number, name); } \
+    void name(void)
+
+#define HAL_REGISTER_READ(reg) ((__typeof__(reg)) hal_host_register_read(&(reg)))
+#define HAL_REGISTER_WRITE(reg, value) hal_host_register_write(&(reg), (value))
+#define HAL_POLL() hal_host_poll() // модель продвигается до следующего события периферии
+
+#define HAL_ADDRESS(pointer) hal_host_address(pointer)
+#define HAL_MEMORY(address) hal_host_memory(address)
+
+#endif
+
+#endif //HAL_H
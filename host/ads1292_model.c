@@ -0,0 +1,438 @@
+/**
+ * Модель ADS1292 для msp430_host: SPI (hal_host_spi_exchange), DRDY на P1.2, CS/RESET/START на P4.4-P4.6.
+ *
+ * Команды разбираются побайтно как их отправляет ads1292.c: WAKEUP, STANDBY, RESET, START, STOP,
+ * RDATAC, SDATAC, RDATA, RREG и WREG (два байта опкода + данные регистров).
+ * Как и у ADS, после включения и RESET включен режим RDATAC, а в нем RREG/WREG игнорируются
+ * (считаются в отчете: прошивка должна оборачивать их в SDATAC ... RDATAC).
+ *
+ * ADS тактируется SMCLK с P1.4 (ads_init): fMOD = fCLK / 4 или fCLK / 16 (LOFF_STAT.CLK_DIV),
+ * частота данных fMOD / OSR задается CONFIG1.DR. Измерения идут после START (команда или вывод P4.6),
+ * первое через 4 периода (установление фильтра), CONFIG1.SINGLE_SHOT - одно измерение на START.
+ * Измерение: слово статуса 1100|LOFF_STAT[4:0]|GPIO[1:0]|0... и по 3 байта на канал (старший первый).
+ *
+ * Сигнал каналов выбирает CHnSET.MUX: 0101 - внутренний тестовый сигнал (CONFIG2.INT_TEST, TEST_FREQ),
+ * 0000 - электроды, на них MSP430_HOST_ADS_SIGNAL:
+ *   ecg (по умолчанию) - синтетическая ЭКГ 72 уд/мин, R зубец 1 мВ
+ *   sine - синус 10 Гц, 1 мВ
+ *   leadoff - ЭКГ, но по нечетным секундам электроды IN1P-IN2N отключены: канал в насыщении,
+ *             в LOFF_STAT биты электродов, включенных в LOFF_SENS (при CONFIG2.PDB_LOFF_COMP)
+ * остальные входы (и выключенный канал) дают 0.
+ *
+ * Вывод RESET опрашивается при обмене по SPI и событиях модели: пока он в 0 ADS не отвечает,
+ * после отпускания регистры сбрасываются (короткий импульс между ними не виден, но после включения
+ * регистры и так в начальном состоянии).
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hal.h"
+#include "host/hal_host.h"
+#include "ads1292.h"
+
+#define DRDY_BIT BIT2
+#define CS_BIT BIT4 // P4
+#define RESET_BIT BIT5 // P4
+#define START_BIT BIT6 // P4
+#define ADS_SAMPLE_SIZE (ADS_SAMPLE_BYTES * (ADS_NUMBER_OF_CHANNELS + 1))
+
+/******** регистры ADS1292 (из data sheet) *********/
+#define REG_ID        0x00
+#define REG_CONFIG1   0x01
+#define REG_CONFIG2   0x02
+#define REG_CH1SET    0x04
+#define REG_LOFF_SENS 0x07
+#define REG_LOFF_STAT 0x08
+#define REG_GPIO      0x0B
+
+#define CONFIG1_SINGLE_SHOT  0x80
+#define CONFIG1_DR           0x07
+#define CONFIG2_PDB_LOFF_COMP 0x40
+#define CONFIG2_VREF_4V      0x10
+#define CONFIG2_INT_TEST     0x02
+#define CONFIG2_TEST_FREQ    0x01
+#define CHSET_PD             0x80
+#define CHSET_GAIN           0x70
+#define CHSET_MUX            0x0F
+#define MUX_NORMAL           0x00
+#define MUX_TEST             0x05
+#define LOFF_STAT_CLK_DIV    0x40
+#define LOFF_STAT_STATUS     0x1F // биты состояния электродов только для чтения
+
+static const uchar reset_values[ADS_NUMBER_OF_REGISTERS] = {
+        0x53, // ID: ADS1292
+        0x02, // CONFIG1: 500 SPS при fMOD 128 kHz
+        0x80, // CONFIG2
+        0x10, // LOFF
+        0x00, // CH1SET
+        0x00, // CH2SET
+        0x00, // RLD_SENS
+        0x00, // LOFF_SENS
+        0x00, // LOFF_STAT
+        0x02, // RESP1
+        0x02, // RESP2
+        0x0C  // GPIO
+};
+
+/******** ADS ONE BYTE COMMANDS (from data sheet) *********/
+#define ADS_WAKEUP   0x02
+#define ADS_STANDBY  0x04
+#define ADS_RESET    0x06
+#define ADS_START    0x08
+#define ADS_STOP     0x0A
+#define ADS_RDATAC   0x10
+#define ADS_SDATAC   0x11
+#define ADS_RDATA    0x12
+#define ADS_OFFSETCAL 0x1A
+#define ADS_RREG     0x20 // 001r rrrr, 000n nnnn
+#define ADS_WREG     0x40 // 010r rrrr, 000n nnnn
+
+static uchar registers[ADS_NUMBER_OF_REGISTERS];
+static bool in_reset;
+static bool rdatac;
+static bool standby;
+static bool converting; // после START (команды или вывода)
+static bool start_pin;
+static hal_host_time conversion_time; // время следующего измерения
+
+// разбор RREG/WREG: опкод, затем число регистров, затем (для WREG) их значения
+static uchar reg_opcode; // 0 - ждем команду
+static bool reg_count_received;
+static uchar reg_address;
+static uchar reg_bytes_left;
+
+/**
+ * Что ADS выдвинет на DOUT в следующих байтах: измерение (RDATAC, RDATA) или значения регистров (RREG).
+ */
+static uchar output[ADS_SAMPLE_SIZE > ADS_NUMBER_OF_REGISTERS ? ADS_SAMPLE_SIZE : ADS_NUMBER_OF_REGISTERS];
+static uchar output_size;
+static uchar output_index;
+static bool output_is_sample;
+static uchar sample[ADS_SAMPLE_SIZE]; // последнее измерение (для RDATA)
+
+// сигнал на электродах (MSP430_HOST_ADS_SIGNAL)
+typedef enum {
+    SIGNAL_ECG,
+    SIGNAL_SINE,
+    SIGNAL_LEADOFF
+} SIGNAL;
+static SIGNAL input_signal;
+
+// статистика для отчета
+static unsigned int bytes_read; // байт измерения прочитано после последнего DRDY
+static bool recording; // прерывание DRDY было разрешено на предыдущем DRDY
+static unsigned long samples_read;
+static unsigned long samples_dropped;
+static unsigned long commands_ignored; // RREG/WREG в режиме RDATAC
+static unsigned long commands_unknown;
+
+static void ads_reset() {
+    memcpy(registers, reset_values, sizeof(registers));
+    rdatac = true;
+    standby = false;
+    converting = false;
+    reg_opcode = 0;
+    output_size = output_index = 0;
+}
+
+// такты MCLK на одно измерение: OSR = 1024 >> DR (DR 110 и 111 - 8 kSPS при fMOD 128 kHz)
+static hal_host_time conversion_period() {
+    uchar dr = registers[REG_CONFIG1] & CONFIG1_DR;
+    if (dr > 6) {
+        dr = 6;
+    }
+    hal_host_time mod_divider = (registers[REG_LOFF_STAT] & LOFF_STAT_CLK_DIV) ? 16 : 4;
+    return (1024 >> dr) * mod_divider * hal_host_smclk_cycles();
+}
+
+static void conversion_start() {
+    converting = true;
+    conversion_time = hal_host_now() + 4 * conversion_period();
+}
+
+// выводы P4 ADS (состояние на момент вызова)
+static void pins_update() {
+    bool reset_pin = (P4OUT & RESET_BIT) == 0;
+    if (reset_pin) {
+        in_reset = true;
+        return;
+    }
+    if (in_reset) {
+        in_reset = false;
+        ads_reset();
+    }
+    bool start = (P4OUT & START_BIT) != 0;
+    if (start && !start_pin) {
+        conversion_start();
+    } else if (!start && start_pin) {
+        converting = false;
+    }
+    start_pin = start;
+}
+
+static void output_load(const uchar* data, uchar size, bool is_sample) {
+    memcpy(output, data, size);
+    output_size = size;
+    output_index = 0;
+    output_is_sample = is_sample;
+}
+
+static void register_write(uchar address, uchar value) {
+    if (address == REG_ID || address >= ADS_NUMBER_OF_REGISTERS) {
+        return;
+    }
+    if (address == REG_LOFF_STAT) {
+        value = (value & ~LOFF_STAT_STATUS) | (registers[REG_LOFF_STAT] & LOFF_STAT_STATUS);
+    }
+    registers[address] = value;
+}
+
+static void register_command(uchar mosi) {
+    if (!reg_count_received) {
+        reg_count_received = true;
+        reg_bytes_left = (mosi & 0x1F) + 1;
+        if (reg_opcode == ADS_RREG) {
+            if (reg_bytes_left > sizeof(output)) {
+                reg_bytes_left = sizeof(output);
+            }
+            for (uchar i = 0; i < reg_bytes_left; i++) {
+                uchar address = reg_address + i;
+                output[i] = (address < ADS_NUMBER_OF_REGISTERS) ? registers[address] : 0;
+            }
+            output_size = reg_bytes_left;
+            output_index = 0;
+            output_is_sample = false;
+            reg_opcode = 0; // значения выдвигаются на DOUT, входные байты снова команды (нули - NOP)
+        }
+        return;
+    }
+    register_write(reg_address++, mosi);
+    if (--reg_bytes_left == 0) {
+        reg_opcode = 0;
+    }
+}
+
+static void command(uchar mosi) {
+    if (reg_opcode != 0) {
+        register_command(mosi);
+        return;
+    }
+    uchar opcode = mosi & 0xE0;
+    if (opcode == ADS_RREG || opcode == ADS_WREG) {
+        if (rdatac) {
+            commands_ignored++;
+            return;
+        }
+        reg_opcode = opcode;
+        reg_address = mosi & 0x1F;
+        reg_count_received = false;
+        return;
+    }
+    switch (mosi) {
+    case 0x00: // NOP (байты чтения)
+    case ADS_OFFSETCAL:
+        break;
+    case ADS_WAKEUP:
+        if (standby && converting) {
+            conversion_start();
+        }
+        standby = false;
+        break;
+    case ADS_STANDBY:
+        standby = true;
+        break;
+    case ADS_RESET:
+        ads_reset();
+        break;
+    case ADS_START:
+        conversion_start();
+        break;
+    case ADS_STOP:
+        converting = false;
+        break;
+    case ADS_RDATAC:
+        rdatac = true;
+        break;
+    case ADS_SDATAC:
+        rdatac = false;
+        break;
+    case ADS_RDATA:
+        output_load(sample, sizeof(sample), true);
+        break;
+    default:
+        commands_unknown++;
+        break;
+    }
+}
+
+unsigned char hal_host_spi_exchange(unsigned char mosi) {
+    pins_update();
+    if (in_reset || (P4OUT & CS_BIT) != 0) {
+        return 0; // DOUT в третьем состоянии
+    }
+    uchar miso = 0;
+    if (output_index < output_size) {
+        miso = output[output_index++];
+        if (output_is_sample && bytes_read++ == 0) {
+            hal_host_port1_input(DRDY_BIT, true); // DRDY снимается с началом чтения
+        }
+    }
+    command(mosi);
+    return miso;
+}
+
+/******** сигналы *********/
+#define PI 3.14159265358979323846
+#define ECG_BEAT_PERIOD (60.0 / 72)
+#define ECG_R_TIME 0.35 // положение R зубца от начала удара, с
+
+// волны ЭКГ: время относительно R, ширина и амплитуда
+typedef struct {
+    double time;
+    double width;
+    double amplitude;
+} ecg_wave;
+
+static const ecg_wave ecg_waves[] = {
+        {-0.20, 0.025, 0.15e-3}, // P
+        {-0.03, 0.010, -0.10e-3}, // Q
+        {0.00, 0.010, 1.00e-3}, // R
+        {0.03, 0.010, -0.25e-3}, // S
+        {0.30, 0.040, 0.30e-3}, // T
+};
+
+static double ecg(double time) {
+    double t = fmod(time, ECG_BEAT_PERIOD) - ECG_R_TIME;
+    double value = 0;
+    for (unsigned int i = 0; i < sizeof(ecg_waves) / sizeof(ecg_waves[0]); i++) {
+        double x = (t - ecg_waves[i].time) / ecg_waves[i].width;
+        value += ecg_waves[i].amplitude * exp(-x * x / 2);
+    }
+    return value;
+}
+
+// электроды отключены (биты LOFF_STAT IN1P-IN2N)
+static uchar electrodes_off(double time) {
+    return (input_signal == SIGNAL_LEADOFF && ((long)time & 1) != 0) ? 0x0F : 0;
+}
+
+static double vref() {
+    return (registers[REG_CONFIG2] & CONFIG2_VREF_4V) ? 4.033 : 2.42;
+}
+
+// тестовый сигнал ±(VREFP - VREFN) / 2400: постоянный или меандр 1 Гц
+static double test_signal(double time) {
+    uchar config2 = registers[REG_CONFIG2];
+    if ((config2 & CONFIG2_INT_TEST) == 0) {
+        return 0;
+    }
+    double amplitude = vref() / 2400;
+    if ((config2 & CONFIG2_TEST_FREQ) && fmod(time, 1.0) >= 0.5) {
+        return -amplitude;
+    }
+    return amplitude;
+}
+
+static long channel_code(uchar channel, double time) {
+    static const uchar gains[8] = {6, 1, 2, 3, 4, 8, 12, 6};
+    uchar chset = registers[REG_CH1SET + channel];
+    if (chset & CHSET_PD) {
+        return 0;
+    }
+    double volts;
+    switch (chset & CHSET_MUX) {
+    case MUX_NORMAL:
+        if (electrodes_off(time) & (0x03 << (channel * 2))) {
+            return 0x7FFFFF; // вход без электрода уходит в насыщение
+        }
+        volts = (input_signal == SIGNAL_SINE) ? 1e-3 * sin(2 * PI * 10 * time) : ecg(time);
+        break;
+    case MUX_TEST:
+        volts = test_signal(time);
+        break;
+    default:
+        return 0;
+    }
+    double code = volts * gains[(chset & CHSET_GAIN) >> 4] / vref() * 0x800000;
+    if (code >= 0x7FFFFF) {
+        return 0x7FFFFF;
+    }
+    if (code <= -0x800000) {
+        return -0x800000;
+    }
+    return lround(code);
+}
+
+static void sample_convert() {
+    double time = (double)hal_host_now() / HAL_HOST_MCLK_HZ;
+    uchar loff = 0;
+    if (registers[REG_CONFIG2] & CONFIG2_PDB_LOFF_COMP) {
+        loff = electrodes_off(time) & registers[REG_LOFF_SENS];
+    }
+    registers[REG_LOFF_STAT] = (registers[REG_LOFF_STAT] & ~LOFF_STAT_STATUS) | loff;
+    uchar gpio = registers[REG_GPIO] & 0x03;
+    sample[0] = 0xC0 | (loff >> 1);
+    sample[1] = ((loff & 0x01) << 7) | (gpio << 5);
+    sample[2] = 0;
+    uchar* data = sample + ADS_SAMPLE_BYTES;
+    for (uchar channel = 0; channel < ADS_NUMBER_OF_CHANNELS; channel++) {
+        unsigned long code = (unsigned long)channel_code(channel, time);
+        data[0] = code >> 16;
+        data[1] = code >> 8;
+        data[2] = code;
+        data += ADS_SAMPLE_BYTES;
+    }
+}
+
+/******** события модели *********/
+static hal_host_time ads_next() {
+    pins_update();
+    return (converting && !standby && !in_reset) ? conversion_time : HAL_HOST_NEVER;
+}
+
+static void ads_fire() {
+    if (recording) {
+        if (bytes_read >= ADS_SAMPLE_SIZE) {
+            samples_read++;
+        } else {
+            samples_dropped++;
+        }
+    }
+    recording = (P1IE & DRDY_BIT) != 0;
+    bytes_read = 0;
+
+    sample_convert();
+    if (rdatac) {
+        output_load(sample, sizeof(sample), true);
+    }
+    // не прочитанное измерение: DRDY поднимается перед следующим
+    hal_host_port1_input(DRDY_BIT, true);
+    hal_host_port1_input(DRDY_BIT, false);
+    if (registers[REG_CONFIG1] & CONFIG1_SINGLE_SHOT) {
+        converting = false;
+    }
+    conversion_time += conversion_period();
+}
+
+static void ads_report(FILE* out) {
+    fprintf(out, "  ads1292 %.0f sps: samples read %lu, dropped %lu, commands ignored in RDATAC %lu, unknown %lu\n",
+            (double)HAL_HOST_MCLK_HZ / conversion_period(), samples_read, samples_dropped,
+            commands_ignored, commands_unknown);
+}
+
+static const hal_host_device ads_device = {ads_next, ads_fire, ads_report};
+
+static void __attribute__((constructor)) ads_register() {
+    const char* signal = getenv("MSP430_HOST_ADS_SIGNAL");
+    if (signal != NULL && strcmp(signal, "sine") == 0) {
+        input_signal = SIGNAL_SINE;
+    } else if (signal != NULL && strcmp(signal, "leadoff") == 0) {
+        input_signal = SIGNAL_LEADOFF;
+    } else {
+        input_signal = SIGNAL_ECG;
+    }
+    ads_reset();
+    in_reset = true; // до первого опроса вывода RESET
+    *(volatile unsigned char*)&P1IN |= DRDY_BIT; // DRDY неактивен после включения, без фронта
+    hal_host_device_register(&ads_device);
+}
@@ -0,0 +1,293 @@
+/**
+ * Декодер потока фреймов данных (см. формат в databatch.c и rice.c) для хоста.
+ * Читает бинарный поток из stdin, печатает каждый фрейм в stdout:
+ * номер фрейма, измерения каналов ADS (знаковые 24-битные), акселерометр, батарею и lead-off статус.
+ *
+ * Использование: batch_decoder [-l record_length] [-o] divider_1 ... divider_N < stream.bin
+ * Делители, длина записи и опции должны совпадать с переданными в ADS_START_RECORDING
+ * (-o - опция DATABATCH_LEAD_OFF, сжатие определяется по маркеру фрейма).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define START_MARKER 0xAA
+#define STOP_MARKER 0x55
+#define FRAME_MARKER 0xA8 // второй байт фрейма: FRAME_MARKER | флаги
+#define FRAME_FLAGS 0x03
+#define FRAME_COMPRESSED 0x01
+#define FRAME_BATTERY 0x02
+#define BATCH_HEADER_SIZE 4
+#define BATCH_TAIL_SIZE 9 // акселерометр(6) + CRC(2) + STOP_MARKER, без батареи и lead-off
+#define BATTERY_SIZE 2
+#define SAMPLE_BYTES 3
+#define RICE_ESCAPE 8
+#define MAX_CHANNELS 8
+#define MAX_RECORD_LENGTH 250
+
+static int number_of_channels;
+static int dividers[MAX_CHANNELS];
+static int record_length = 10;
+static size_t lead_off_size; // 0 - lead-off не передается
+static size_t tail_size; // размер хвоста текущего фрейма
+static long samples[MAX_CHANNELS][MAX_RECORD_LENGTH];
+static int sample_counts[MAX_CHANNELS];
+static unsigned long crc_errors;
+
+/*------------------ CRC-16/CCITT-FALSE (как crc16.c) ------------------*/
+static unsigned crc16(unsigned crc, const unsigned char* data, size_t size) {
+    while (size-- > 0) {
+        crc ^= (unsigned) *data++ << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+        crc &= 0xFFFF;
+    }
+    return crc;
+}
+
+static unsigned crc16_word(unsigned crc, unsigned word) {
+    unsigned char bytes[2] = {(unsigned char) word, (unsigned char) (word >> 8)};
+    return crc16(crc, bytes, 2);
+}
+
+/**
+ * CRC фрейма: заголовок | CRC каждой области данных ADS | акселерометр, батарея и lead-off
+ * (см. формат в databatch.c)
+ */
+static int frame_crc_ok(const unsigned char* frame, size_t header_size, size_t frame_size,
+                        const size_t* region_sizes, int number_of_regions) {
+    unsigned crc = crc16(0xFFFF, frame, header_size);
+    const unsigned char* region = frame + header_size;
+    for (int i = 0; i < number_of_regions; i++) {
+        crc = crc16_word(crc, crc16(0xFFFF, region, region_sizes[i]));
+        region += region_sizes[i];
+    }
+    const unsigned char* tail = frame + frame_size - tail_size;
+    size_t crc_offset = tail_size - 3;
+    crc = crc16(crc, tail, crc_offset);
+    return crc == (unsigned) (tail[crc_offset] | (tail[crc_offset + 1] << 8));
+}
+
+/*------------------ чтение битового потока ------------------*/
+static const unsigned char* bit_data;
+static size_t bit_size;
+static size_t bit_position;
+static int bit_error;
+
+static unsigned long get_bits(int n) {
+    unsigned long value = 0;
+    for (int i = 0; i < n; i++) {
+        size_t byte = bit_position >> 3;
+        if (byte >= bit_size) {
+            bit_error = 1;
+            return 0;
+        }
+        value = (value << 1) | ((bit_data[byte] >> (7 - (bit_position & 7))) & 1);
+        bit_position++;
+    }
+    return value;
+}
+
+static long sign_extend_24(unsigned long value) {
+    value &= 0xFFFFFFUL;
+    return (value & 0x800000UL) ? (long) value - 0x1000000L : (long) value;
+}
+
+/*------------------ разбор фреймов ------------------*/
+static int channel_enabled(int channel) {
+    int divider = dividers[channel];
+    return divider > 0 && divider <= record_length && (record_length % divider) == 0;
+}
+
+static size_t raw_payload_size(void) {
+    size_t size = 0;
+    for (int i = 0; i < number_of_channels; i++) {
+        if (channel_enabled(i)) {
+            size += (size_t) (record_length / dividers[i]) * SAMPLE_BYTES;
+        }
+    }
+    return size;
+}
+
+static void decode_raw(const unsigned char* payload) {
+    for (int i = 0; i < number_of_channels; i++) {
+        sample_counts[i] = 0;
+        if (!channel_enabled(i)) {
+            continue;
+        }
+        int n = record_length / dividers[i];
+        for (int j = 0; j < n; j++) {
+            unsigned long value = payload[0] | ((unsigned long) payload[1] << 8) | ((unsigned long) payload[2] << 16);
+            samples[i][j] = sign_extend_24(value);
+            payload += SAMPLE_BYTES;
+        }
+        sample_counts[i] = n;
+    }
+}
+
+static int decode_compressed(const unsigned char* parameters, const unsigned char* payload, size_t payload_size) {
+    unsigned long previous[MAX_CHANNELS] = {0};
+    bit_data = payload;
+    bit_size = payload_size;
+    bit_position = 0;
+    bit_error = 0;
+    for (int i = 0; i < number_of_channels; i++) {
+        sample_counts[i] = 0;
+    }
+    for (int s = 0; s < record_length; s++) {
+        for (int i = 0; i < number_of_channels; i++) {
+            if (!channel_enabled(i) || (s % dividers[i]) != 0) {
+                continue;
+            }
+            unsigned long value;
+            if (s == 0) {
+                value = get_bits(24);
+            } else {
+                int k = parameters[i];
+                unsigned long q = 0;
+                while (q < RICE_ESCAPE && get_bits(1) == 1) {
+                    q++;
+                }
+                unsigned long u = (q == RICE_ESCAPE) ? get_bits(24) : ((q << k) | get_bits(k));
+                unsigned long delta = (u & 1) ? ~(u >> 1) : (u >> 1);
+                value = (previous[i] + delta) & 0xFFFFFFUL;
+            }
+            previous[i] = value;
+            samples[i][sample_counts[i]++] = sign_extend_24(value);
+        }
+    }
+    return !bit_error;
+}
+
+static void print_frame(unsigned counter, int compressed, int battery, const unsigned char* tail) {
+    printf("frame %u%s\n", counter, compressed ? " compressed" : "");
+    for (int i = 0; i < number_of_channels; i++) {
+        if (!channel_enabled(i)) {
+            continue;
+        }
+        printf("  ch%d:", i + 1);
+        for (int j = 0; j < sample_counts[i]; j++) {
+            printf(" %ld", samples[i][j]);
+        }
+        printf("\n");
+    }
+    printf("  acc: %u %u %u", tail[0] | (tail[1] << 8), tail[2] | (tail[3] << 8), tail[4] | (tail[5] << 8));
+    tail += 6;
+    if (battery) {
+        printf(" battery: %u", tail[0] | (tail[1] << 8));
+        tail += BATTERY_SIZE;
+    }
+    printf("\n");
+    if (lead_off_size > 0) {
+        unsigned lead_off = tail[0] | (lead_off_size > 1 ? tail[1] << 8 : 0);
+        printf("  lead-off: 0x%02X\n", lead_off);
+    }
+}
+
+/**
+ * Пытается разобрать фрейм начиная с data[0].
+ * Возвращает размер фрейма или 0 если это не фрейм (тогда ищем начало со следующего байта)
+ */
+static size_t parse_frame(const unsigned char* data, size_t size) {
+    if (size < BATCH_HEADER_SIZE || data[0] != START_MARKER) {
+        return 0;
+    }
+    unsigned counter = data[2] | (data[3] << 8);
+    if ((data[1] & ~FRAME_FLAGS) != FRAME_MARKER) {
+        return 0;
+    }
+    int battery = (data[1] & FRAME_BATTERY) != 0;
+    tail_size = BATCH_TAIL_SIZE + lead_off_size + (battery ? BATTERY_SIZE : 0);
+    if ((data[1] & FRAME_COMPRESSED) == 0) {
+        size_t frame_size = BATCH_HEADER_SIZE + raw_payload_size() + tail_size;
+        if (frame_size > size || data[frame_size - 1] != STOP_MARKER) {
+            return 0;
+        }
+        size_t region_sizes[MAX_CHANNELS];
+        int number_of_regions = 0;
+        for (int i = 0; i < number_of_channels; i++) {
+            if (channel_enabled(i)) {
+                region_sizes[number_of_regions++] = (size_t) (record_length / dividers[i]) * SAMPLE_BYTES;
+            }
+        }
+        if (!frame_crc_ok(data, BATCH_HEADER_SIZE, frame_size, region_sizes, number_of_regions)) {
+            crc_errors++;
+            return 0;
+        }
+        decode_raw(data + BATCH_HEADER_SIZE);
+        print_frame(counter, 0, battery, data + frame_size - tail_size);
+        return frame_size;
+    }
+    // сжатый фрейм
+    size_t header_size = BATCH_HEADER_SIZE + 2 + number_of_channels;
+    if (header_size > size) {
+        return 0;
+    }
+    size_t payload_size = data[4] | (data[5] << 8);
+    size_t frame_size = header_size + payload_size + tail_size;
+    if (frame_size > size || data[frame_size - 1] != STOP_MARKER) {
+        return 0;
+    }
+    if (!frame_crc_ok(data, header_size, frame_size, &payload_size, 1)) {
+        crc_errors++;
+        return 0;
+    }
+    if (!decode_compressed(data + BATCH_HEADER_SIZE + 2, data + header_size, payload_size)) {
+        return 0;
+    }
+    print_frame(counter, 1, battery, data + frame_size - tail_size);
+    return frame_size;
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            record_length = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            lead_off_size = 1;
+        } else if (number_of_channels < MAX_CHANNELS) {
+            dividers[number_of_channels++] = atoi(argv[i]);
+        }
+    }
+    if (number_of_channels == 0 || record_length <= 0 || record_length > MAX_RECORD_LENGTH) {
+        fprintf(stderr, "usage: %s [-l record_length] [-o] divider_1 ... divider_N < stream\n", argv[0]);
+        return 1;
+    }
+    if (lead_off_size > 0 && number_of_channels > 2) {
+        lead_off_size = 2; // восьмиканалка
+    }
+
+    size_t capacity = 1 << 16;
+    size_t size = 0;
+    unsigned char* data = malloc(capacity);
+    size_t n;
+    while (data != NULL && (n = fread(data + size, 1, capacity - size, stdin)) > 0) {
+        size += n;
+        if (size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    if (data == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    size_t position = 0;
+    size_t skipped = 0;
+    while (position < size) {
+        size_t frame_size = parse_frame(data + position, size - position);
+        if (frame_size == 0) {
+            position++;
+            skipped++;
+        } else {
+            position += frame_size;
+        }
+    }
+    if (skipped > 0) {
+        fprintf(stderr, "%zu bytes skipped, %lu frames with bad CRC\n", skipped, crc_errors);
+    }
+    free(data);
+    return 0;
+}
@@ -0,0 +1,839 @@
+/**
+ * Модель MSP430F2274 для цели msp430_host (см. hal.h и host/hal_host.h).
+ *
+ * Процессор: GIE, LPM0 и таблица векторов. Прерывания доставляются когда прошивка
+ * разрешает их (__eint, __set_interrupt_state) и пока она спит, в порядке приоритета векторов.
+ * Периферия: очередное событие (конец байта USCI, совпадение Timer_B, запуск и конец
+ * последовательности ADC10, события внешних устройств) выбирается по времени, время модели перескакивает к нему.
+ * Код прошивки занимает время по числу выполненных базовых блоков (см. code_pause), по окончании
+ * в stderr печатается отчет: загрузка процессора, задержки и запас прерываний, потерянные данные.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "host/hal_host.h"
+
+static hal_host_time now;
+static hal_host_time time_limit;
+
+hal_host_time hal_host_now() {
+    return now;
+}
+
+static void hal_host_finish();
+static bool periphery_step_until(hal_host_time limit);
+
+/*------------------------------ такты ----------------------------------*/
+// все тактовые сигналы от одного кварца 16 MHz (см. clock_init), делители - из BCSCTL1/BCSCTL2
+static hal_host_time aclk_cycles() {
+    return 1 << ((BCSCTL1 & DIVA_3) >> 4);
+}
+
+hal_host_time hal_host_smclk_cycles() {
+    return 1 << ((BCSCTL2 & DIVS_3) >> 1);
+}
+
+// такты MCLK на тик таймера: источник TASSEL/TBSSEL (биты 8-9) и делитель ID (биты 6-7), 0 - источник не моделируется
+static hal_host_time timer_tick_cycles(unsigned int control) {
+    hal_host_time cycles;
+    switch (control & TASSEL_3) {
+    case TASSEL_1:
+        cycles = aclk_cycles();
+        break;
+    case TASSEL_2:
+        cycles = hal_host_smclk_cycles();
+        break;
+    default:
+        return 0;
+    }
+    return cycles << ((control & ID_3) >> 6);
+}
+
+/*------------------------------ процессор ------------------------------*/
+#define VECTORS 16
+#define CONTEXT_MAIN (-1)
+#define ISR_ENTRY_CYCLES 6 // прием прерывания: PC и SR в стек, переход по вектору
+#define ISR_RETURN_CYCLES 5 // RETI
+
+static void (*isr_table[VECTORS])(void);
+static bool gie;
+static bool wake_up;
+static int context = CONTEXT_MAIN; // вектор выполняемого обработчика
+
+static const char* const vector_names[VECTORS] = {
+    [PORT1_VECTOR / 2] = "PORT1",
+    [ADC10_VECTOR / 2] = "ADC10",
+    [USCIAB0TX_VECTOR / 2] = "USCIAB0TX",
+    [USCIAB0RX_VECTOR / 2] = "USCIAB0RX",
+    [TIMERB1_VECTOR / 2] = "TIMERB1",
+};
+
+typedef struct {
+    unsigned long count;
+    hal_host_time busy; // такты в обработчике
+    hal_host_time max_latency; // от флага до входа в обработчик
+    hal_host_time min_slack; // от выхода из обработчика до следующего флага
+    hal_host_time request; // флаг выставлен
+    hal_host_time returned; // последний выход из обработчика
+    bool pending;
+} interrupt_stats;
+
+static interrupt_stats interrupts[VECTORS];
+static hal_host_time main_busy;
+
+void hal_host_isr_register(unsigned int vector, void (*isr)(void)) {
+    isr_table[vector / 2] = isr;
+}
+
+// флаг и разрешение прерывания выставлены (биты IE2 и IFG2 USCI совпадают)
+static bool interrupt_pending(unsigned int vector) {
+    switch (vector) {
+    case TIMERB1_VECTOR:
+        return ((TBCCTL1 & (CCIE + CCIFG)) == CCIE + CCIFG) || ((TBCCTL2 & (CCIE + CCIFG)) == CCIE + CCIFG);
+    case USCIAB0RX_VECTOR:
+        return (IE2 & IFG2 & (UCA0RXIFG + UCB0RXIFG)) != 0;
+    case USCIAB0TX_VECTOR:
+        return (IE2 & IFG2 & (UCA0TXIFG + UCB0TXIFG)) != 0;
+    case ADC10_VECTOR:
+        return (ADC10CTL0 & (ADC10IE + ADC10IFG)) == ADC10IE + ADC10IFG;
+    case PORT1_VECTOR:
+        return (P1IE & P1IFG) != 0;
+    default:
+        return false;
+    }
+}
+
+// запоминает момент появления запросов прерываний; запрос во время своего же обработчика - запас 0
+static void interrupts_update() {
+    for (int vector = 0; vector < VECTORS; vector++) {
+        interrupt_stats* stats = &interrupts[vector];
+        bool pending = isr_table[vector] != NULL && interrupt_pending(vector * 2);
+        if (pending && !stats->pending) {
+            stats->request = now;
+            if (stats->count != 0) {
+                hal_host_time slack = (vector == context) ? 0 : now - stats->returned;
+                if (slack < stats->min_slack) {
+                    stats->min_slack = slack;
+                }
+            }
+        }
+        stats->pending = pending;
+    }
+}
+
+static void interrupts_deliver();
+
+/**
+ * Процессор занят cycles тактов (код прошивки или ожидание в цикле опроса).
+ * Периферия за это время продвигается, прерывания (если разрешены) вклиниваются и отодвигают конец.
+ */
+static void cpu_busy(hal_host_time cycles) {
+    hal_host_time end = now + cycles;
+    if (context == CONTEXT_MAIN) {
+        main_busy += cycles;
+    } else {
+        interrupts[context].busy += cycles;
+    }
+    while (periphery_step_until(end)) {
+        if (gie) {
+            hal_host_time interrupted = now;
+            interrupts_deliver();
+            end += now - interrupted;
+        }
+    }
+    now = end;
+    if (now > time_limit) {
+        hal_host_finish();
+    }
+}
+
+/*------------------------- время выполнения кода -------------------------*/
+/**
+ * Код прошивки выполняется на хосте, его длительность на MSP430 оценивается по числу выполненных
+ * базовых блоков: исходники прошивки собираются с -fsanitize-coverage=trace-pc (см. CMakeLists.txt),
+ * и компилятор вызывает __sanitizer_cov_trace_pc в каждом блоке.
+ * Блок стоит cycles_per_block тактов (MSP430_HOST_CYCLES_PER_BLOCK, 0 - код выполняется мгновенно).
+ * Оценка детерминирована и не зависит от хоста, но приблизительна: IAR разбивает код на блоки
+ * иначе, а умножение и 32-битная арифметика на MSP430 без умножителя стоят десятки тактов.
+ */
+#define DEFAULT_CYCLES_PER_BLOCK 6 // 2-3 инструкции по 2-3 такта (операнды в памяти)
+
+static unsigned long long code_blocks; // выполнено блоков прошивки
+static unsigned long long code_start_blocks;
+static hal_host_time cycles_per_block = DEFAULT_CYCLES_PER_BLOCK;
+static bool code_running = true;
+
+void __sanitizer_cov_trace_pc(void) {
+    code_blocks++;
+}
+
+// прошивка получает управление
+static void code_resume() {
+    code_running = true;
+    code_start_blocks = code_blocks;
+}
+
+// прошивка вошла в модель: процессор был занят кодом с прошлого code_resume
+static void code_pause() {
+    if (!code_running) {
+        return;
+    }
+    code_running = false;
+    cpu_busy((code_blocks - code_start_blocks) * cycles_per_block);
+}
+
+// вызывает обработчики пока есть прерывания, старший вектор - старший приоритет
+static void interrupt_run(int vector) {
+    interrupt_stats* stats = &interrupts[vector];
+    int interrupted = context;
+    stats->count++;
+    if (now - stats->request > stats->max_latency) {
+        stats->max_latency = now - stats->request;
+    }
+    if (vector * 2 == ADC10_VECTOR) {
+        ADC10CTL0 &= ~ADC10IFG; // флаг с одним источником сбрасывается при входе в прерывание
+    }
+    gie = false;
+    context = vector;
+    cpu_busy(ISR_ENTRY_CYCLES);
+    code_resume();
+    isr_table[vector]();
+    code_pause();
+    cpu_busy(ISR_RETURN_CYCLES);
+    stats->returned = now;
+    stats->pending = false; // флаг выставленный после выхода из обработчика - новый запрос
+    context = interrupted;
+    gie = true;
+}
+
+static void interrupts_deliver() {
+    int vector = VECTORS - 1;
+    interrupts_update();
+    while (gie && vector >= 0) {
+        if (isr_table[vector] == NULL || !interrupt_pending(vector * 2)) {
+            vector--;
+            continue;
+        }
+        interrupt_run(vector);
+        interrupts_update();
+        vector = VECTORS - 1;
+    }
+}
+
+/*------------------------------ USCI -----------------------------------*/
+// передатчик USCI: TXBUF и сдвиговый регистр
+typedef struct {
+    bool shifting; // байт в сдвиговом регистре
+    unsigned char shift;
+    bool buffered; // следующий байт ждет в TXBUF
+    unsigned char buffer;
+    hal_host_time done; // байт выйдет из сдвигового регистра
+} usci_transmitter;
+
+static usci_transmitter uart_tx;
+static usci_transmitter spi_tx;
+
+#define UART_FRAME_BITS 10 // старт + 8 бит + стоп
+#define SPI_FRAME_BITS 8
+
+static hal_host_time usci_clock_cycles(unsigned char control1) {
+    return ((control1 & UCSSEL_3) == UCSSEL_1) ? aclk_cycles() : hal_host_smclk_cycles();
+}
+
+// длительность байта UART по UCA0BR и модуляции UCA0MCTL (MSP430x2xx Family User's Guide, 15.3.10)
+static hal_host_time uart_frame_cycles() {
+    hal_host_time br = UCA0BR0 + (UCA0BR1 << 8);
+    hal_host_time frame;
+    if (UCA0MCTL & UCOS16) {
+        frame = UART_FRAME_BITS * (16 * br + ((UCA0MCTL & UCBRF_15) >> 4));
+    } else {
+        frame = (UART_FRAME_BITS * (8 * br + ((UCA0MCTL & UCBRS_7) >> 1))) / 8;
+    }
+    if (frame == 0) {
+        frame = UART_FRAME_BITS;
+    }
+    return frame * usci_clock_cycles(UCA0CTL1);
+}
+
+static hal_host_time spi_frame_cycles() {
+    hal_host_time br = UCB0BR0 + (UCB0BR1 << 8);
+    if (br == 0) {
+        br = 1;
+    }
+    return SPI_FRAME_BITS * br * usci_clock_cycles(UCB0CTL1);
+}
+
+// запись в TXBUF: свободный сдвиговый регистр забирает байт сразу, иначе байт ждет и TXIFG сброшен
+static void usci_write(usci_transmitter* tx, unsigned char value, unsigned char txifg, volatile unsigned char* status,
+                       hal_host_time frame) {
+    if (tx->shifting) {
+        tx->buffered = true;
+        tx->buffer = value;
+        IFG2 &= ~txifg;
+    } else {
+        tx->shifting = true;
+        tx->shift = value;
+        tx->done = now + frame;
+        *status |= UCBUSY;
+    }
+}
+
+// байт вышел из сдвигового регистра, возвращает его; байт из TXBUF (если есть) переходит в сдвиговый регистр
+static unsigned char usci_shifted(usci_transmitter* tx, unsigned char txifg, volatile unsigned char* status,
+                                  hal_host_time frame) {
+    unsigned char value = tx->shift;
+    if (tx->buffered) {
+        tx->buffered = false;
+        tx->shift = tx->buffer;
+        tx->done = now + frame;
+        IFG2 |= txifg;
+    } else {
+        tx->shifting = false;
+        *status &= ~UCBUSY;
+    }
+    return value;
+}
+
+static hal_host_time uart_tx_next() {
+    return uart_tx.shifting ? uart_tx.done : HAL_HOST_NEVER;
+}
+
+static void uart_tx_fire() {
+    putchar(usci_shifted(&uart_tx, UCA0TXIFG, &UCA0STAT, uart_frame_cycles()));
+}
+
+// на шине SPI по умолчанию никого нет
+__attribute__((weak)) unsigned char hal_host_spi_exchange(unsigned char mosi) {
+    (void)mosi;
+    return 0;
+}
+
+static hal_host_time spi_next() {
+    return spi_tx.shifting ? spi_tx.done : HAL_HOST_NEVER;
+}
+
+static unsigned long spi_overruns;
+static unsigned long uart_rx_overruns;
+
+static void spi_fire() {
+    unsigned char miso = hal_host_spi_exchange(usci_shifted(&spi_tx, UCB0TXIFG, &UCB0STAT, spi_frame_cycles()));
+    if (IFG2 & UCB0RXIFG) {
+        UCB0STAT |= UCOE; // предыдущий байт не прочитан
+        spi_overruns++;
+    }
+    *(volatile unsigned char*)&UCB0RXBUF = miso; // регистры только для чтения (const_sfr) пишет только модель
+    IFG2 |= UCB0RXIFG;
+}
+
+/**
+ * Прием UART: байты stdin идут подряд со скоростью линии пока приемник включен.
+ * Как и настоящий хост, stdin начинает передачу не сразу, а через MSP430_HOST_RX_START_MS
+ * (по умолчанию 10 мс) - байты пришедшие до разрешения прерываний (во время инициализации) были бы потеряны.
+ */
+#define UART_RX_NO_BYTE (-2)
+static int uart_rx_byte = UART_RX_NO_BYTE;
+static hal_host_time uart_rx_done = HAL_HOST_NEVER;
+static hal_host_time uart_rx_start;
+
+static hal_host_time uart_rx_next() {
+    if (UCA0CTL1 & UCSWRST) { // начатый байт пропадает
+        uart_rx_done = HAL_HOST_NEVER;
+        return HAL_HOST_NEVER;
+    }
+    if (uart_rx_byte == UART_RX_NO_BYTE) {
+        uart_rx_byte = getchar();
+    }
+    if (uart_rx_byte == EOF) {
+        return HAL_HOST_NEVER;
+    }
+    if (uart_rx_done == HAL_HOST_NEVER) {
+        uart_rx_done = (now > uart_rx_start ? now : uart_rx_start) + uart_frame_cycles();
+    }
+    return uart_rx_done;
+}
+
+static void uart_rx_fire() {
+    if (IFG2 & UCA0RXIFG) {
+        UCA0STAT |= UCOE;
+        uart_rx_overruns++;
+    }
+    *(volatile unsigned char*)&UCA0RXBUF = (unsigned char)uart_rx_byte;
+    IFG2 |= UCA0RXIFG;
+    uart_rx_byte = UART_RX_NO_BYTE;
+    uart_rx_done = HAL_HOST_NEVER;
+}
+
+/*------------------------------ Timer_B --------------------------------*/
+// счет идет от старта модели, одноразовому планировщику (timer.c) важна только разность TBR и TBCCRx
+static unsigned int timer_b_count() {
+    hal_host_time tick = timer_tick_cycles(TBCTL);
+    if ((TBCTL & MC_3) == 0 || tick == 0) {
+        return TBR;
+    }
+    return (unsigned int)((now / tick) & 0xFFFF);
+}
+
+static volatile unsigned int* const timer_b_compare[] = {&TBCCR1, &TBCCR2};
+static volatile unsigned int* const timer_b_control[] = {&TBCCTL1, &TBCCTL2};
+#define TIMER_B_CHANNELS (sizeof(timer_b_compare) / sizeof(timer_b_compare[0]))
+
+// момент когда счетчик станет равен TBCCRx, HAL_HOST_NEVER если прерывание канала не ждется
+static hal_host_time timer_b_match(unsigned int channel) {
+    hal_host_time tick = timer_tick_cycles(TBCTL);
+    if ((TBCTL & MC_3) == 0 || tick == 0 || (*timer_b_control[channel] & (CCIE + CCIFG)) != CCIE) {
+        return HAL_HOST_NEVER;
+    }
+    hal_host_time ticks = (*timer_b_compare[channel] - timer_b_count()) & 0xFFFF;
+    if (ticks == 0) {
+        ticks = 0x10000; // совпадение с текущим значением уже прошло
+    }
+    return (now / tick + ticks) * tick;
+}
+
+static hal_host_time timer_b_next() {
+    hal_host_time first = HAL_HOST_NEVER;
+    for (unsigned int channel = 0; channel < TIMER_B_CHANNELS; channel++) {
+        hal_host_time match = timer_b_match(channel);
+        if (match < first) {
+            first = match;
+        }
+    }
+    return first;
+}
+
+static void timer_b_fire() {
+    for (unsigned int channel = 0; channel < TIMER_B_CHANNELS; channel++) {
+        // регистр 16-битный: TBR + ticks у конца счета переполняется (unsigned int модели шире)
+        if ((*timer_b_control[channel] & (CCIE + CCIFG)) == CCIE
+            && (*timer_b_compare[channel] & 0xFFFF) == timer_b_count()) {
+            *timer_b_control[channel] |= CCIFG;
+        }
+    }
+}
+
+// чтение TBIV возвращает старший выставленный флаг и сбрасывает его
+static unsigned int timer_b_vector() {
+    if ((TBCCTL1 & (CCIE + CCIFG)) == CCIE + CCIFG) {
+        TBCCTL1 &= ~CCIFG;
+        return TBIV_TBCCR1;
+    }
+    if ((TBCCTL2 & (CCIE + CCIFG)) == CCIE + CCIFG) {
+        TBCCTL2 &= ~CCIFG;
+        return TBIV_TBCCR2;
+    }
+    return TBIV_NONE;
+}
+
+/*------------------------- Timer_A + ADC10 -----------------------------*/
+/**
+ * Timer_A в режиме up с OUTMOD_3 на TACCR1 дает один фронт OUT1 за период, фронт запускает
+ * последовательность ADC10 (SHS_1, CONSEQ_1) от INCHx до A0, DTC пишет ее в память по ADC10SA.
+ * Пока ADC10IFG не сброшен (последовательность не перезапущена в adc10_isr) фронт пропускается.
+ */
+#define ADC10_CONVERSION_CLOCKS 13
+static const unsigned int adc10_sample_clocks[] = {4, 8, 16, 64};
+
+static bool timer_a_running;
+static hal_host_time timer_a_trigger; // ближайший фронт OUT1
+static unsigned long adc10_triggers;
+static unsigned long adc10_skipped;
+static bool adc10_busy;
+static hal_host_time adc10_done;
+
+static unsigned int adc10_channels() {
+    return (ADC10CTL1 >> 12) + 1; // INCHx..A0
+}
+
+static hal_host_time adc10_clock_cycles() {
+    hal_host_time cycles;
+    switch (ADC10CTL1 & ADC10SSEL_3) {
+    case ADC10SSEL_1:
+        cycles = aclk_cycles();
+        break;
+    case ADC10SSEL_2:
+        cycles = 1;
+        break;
+    case ADC10SSEL_3:
+        cycles = hal_host_smclk_cycles();
+        break;
+    default:
+        cycles = 3; // ADC10OSC около 5 MHz
+        break;
+    }
+    return cycles * (((ADC10CTL1 & ADC10DIV_7) >> 5) + 1);
+}
+
+static hal_host_time adc10_sequence_cycles() {
+    hal_host_time clocks = adc10_sample_clocks[(ADC10CTL0 & ADC10SHT_3) >> 11] + ADC10_CONVERSION_CLOCKS;
+    return adc10_channels() * clocks * adc10_clock_cycles();
+}
+
+// значение канала: середина шкалы со сдвигом по номеру канала
+static unsigned int adc10_sample(unsigned int channel) {
+    return 0x200 + channel * 0x10;
+}
+
+static hal_host_time timer_a_next() {
+    hal_host_time tick = timer_tick_cycles(TACTL);
+    if ((TACTL & MC_3) != MC_1 || tick == 0 || (TACCTL1 & OUTMOD_7) != OUTMOD_3) {
+        timer_a_running = false;
+        return HAL_HOST_NEVER;
+    }
+    hal_host_time period = (TACCR0 + 1) * tick;
+    if (!timer_a_running) { // таймер запущен после прошлого шага модели
+        timer_a_running = true;
+        timer_a_trigger = now + TACCR1 * tick;
+    }
+    while (timer_a_trigger < now) {
+        timer_a_trigger += period;
+    }
+    return timer_a_trigger;
+}
+
+static void timer_a_fire() {
+    timer_a_trigger += (TACCR0 + 1) * timer_tick_cycles(TACTL);
+    if ((ADC10CTL0 & (ENC + ADC10ON)) != ENC + ADC10ON || (ADC10CTL1 & SHS_3) != SHS_1) {
+        return;
+    }
+    adc10_triggers++;
+    if (adc10_busy || (ADC10CTL0 & ADC10IFG)) {
+        adc10_skipped++;
+        return;
+    }
+    adc10_busy = true;
+    adc10_done = now + adc10_sequence_cycles();
+    ADC10CTL1 |= ADC10BUSY;
+}
+
+static hal_host_time adc10_next() {
+    return adc10_busy ? adc10_done : HAL_HOST_NEVER;
+}
+
+static void adc10_fire() {
+    unsigned int channel = adc10_channels();
+    unsigned int transfers = ADC10DTC1;
+    for (unsigned int i = 0; i < transfers && channel > 0; i++) {
+        unsigned int value = adc10_sample(--channel);
+        unsigned char* memory = hal_host_memory(ADC10SA + 2 * i);
+        memory[0] = value & 0xFF;
+        memory[1] = value >> 8;
+        ADC10MEM = value;
+    }
+    adc10_busy = false;
+    ADC10CTL1 &= ~ADC10BUSY;
+    ADC10CTL0 |= ADC10IFG;
+}
+
+/*------------------------------ порт 1 ---------------------------------*/
+static unsigned long port1_missed; // фронты пришедшие пока флаг предыдущего не сброшен
+
+void hal_host_port1_input(unsigned char bits, bool high) {
+    unsigned char old = P1IN;
+    unsigned char in = high ? (old | bits) : (old & ~bits);
+    unsigned char changed = old ^ in;
+    // P1IES: 1 - флаг по спаду, 0 - по фронту
+    unsigned char edges = (changed & old & P1IES) | (changed & in & ~P1IES);
+    *(volatile unsigned char*)&P1IN = in;
+    for (unsigned char missed = P1IFG & edges; missed != 0; missed &= missed - 1) {
+        port1_missed++;
+    }
+    P1IFG |= edges;
+}
+
+/*------------------------------ события --------------------------------*/
+static const hal_host_device peripheries[] = {
+    {timer_b_next, timer_b_fire, NULL},
+    {uart_rx_next, uart_rx_fire, NULL},
+    {uart_tx_next, uart_tx_fire, NULL},
+    {spi_next, spi_fire, NULL},
+    {timer_a_next, timer_a_fire, NULL},
+    {adc10_next, adc10_fire, NULL},
+};
+#define PERIPHERIES (sizeof(peripheries) / sizeof(peripheries[0]))
+
+#define DEVICES 4
+static const hal_host_device* devices[DEVICES];
+static unsigned int device_count;
+
+void hal_host_device_register(const hal_host_device* device) {
+    if (device_count == DEVICES) {
+        fprintf(stderr, "msp430_host: too many devices\n");
+        abort();
+    }
+    devices[device_count++] = device;
+}
+
+static unsigned long long periphery_events; // сработало событий периферии
+
+// продвигает модель до ближайшего события, false если событий нет до момента limit
+static bool periphery_step_until(hal_host_time limit) {
+    const hal_host_device* first = NULL;
+    hal_host_time first_time = HAL_HOST_NEVER;
+    for (unsigned int i = 0; i < PERIPHERIES + device_count; i++) {
+        const hal_host_device* device = (i < PERIPHERIES) ? &peripheries[i] : devices[i - PERIPHERIES];
+        hal_host_time time = device->next();
+        if (time < first_time) {
+            first_time = time;
+            first = device;
+        }
+    }
+    if (first == NULL || first_time > limit) {
+        return false;
+    }
+    if (first_time > now) {
+        now = first_time;
+    }
+    first->fire();
+    periphery_events++;
+    interrupts_update();
+    return true;
+}
+
+// ожидание в цикле опроса флага: процессор занят до следующего события
+void hal_host_poll() {
+    unsigned long long events = periphery_events;
+    code_pause();
+    if (periphery_events != events) { // пока выполнялся код цикла периферия уже изменилась, флаг проверим снова
+        code_resume();
+        return;
+    }
+    hal_host_time start = now;
+    if (!periphery_step_until(time_limit)) {
+        hal_host_finish(); // флаг уже никогда не выставится
+    }
+    if (context == CONTEXT_MAIN) {
+        main_busy += now - start;
+    } else {
+        interrupts[context].busy += now - start;
+    }
+    interrupts_deliver();
+    code_resume();
+}
+
+/*------------------------------ отчет ----------------------------------*/
+static double percent(hal_host_time part) {
+    return now == 0 ? 0 : 100.0 * part / now;
+}
+
+static double microseconds(hal_host_time cycles) {
+    return cycles * 1e6 / HAL_HOST_MCLK_HZ;
+}
+
+static void hal_host_report(FILE* out) {
+    hal_host_time busy = main_busy;
+    for (int vector = 0; vector < VECTORS; vector++) {
+        busy += interrupts[vector].busy;
+    }
+    fprintf(out, "msp430_host: %.3f ms, cpu %.1f%% (main %.1f%%), %llu cycles per block\n",
+            microseconds(now) / 1000, percent(busy), percent(main_busy), cycles_per_block);
+    fprintf(out, "  %-10s %10s %7s %16s %16s\n", "interrupt", "count", "cpu %", "max latency us", "min slack us");
+    for (int vector = VECTORS - 1; vector >= 0; vector--) {
+        interrupt_stats* stats = &interrupts[vector];
+        if (isr_table[vector] == NULL) {
+            continue;
+        }
+        fprintf(out, "  %-10s %10lu %7.1f %16.1f ", vector_names[vector], stats->count, percent(stats->busy),
+                microseconds(stats->max_latency));
+        if (stats->min_slack == HAL_HOST_NEVER) {
+            fprintf(out, "%16s\n", "-");
+        } else {
+            fprintf(out, "%16.1f\n", microseconds(stats->min_slack));
+        }
+    }
+    fprintf(out, "  uart rx overruns %lu, spi overruns %lu, port1 missed edges %lu, adc10 triggers %lu (skipped %lu)\n",
+            uart_rx_overruns, spi_overruns, port1_missed, adc10_triggers, adc10_skipped);
+    for (unsigned int i = 0; i < device_count; i++) {
+        if (devices[i]->report != NULL) {
+            devices[i]->report(out);
+        }
+    }
+}
+
+static void hal_host_finish() {
+    fflush(stdout);
+    hal_host_report(stderr);
+    exit(0);
+}
+
+/*------------------------------ регистры -------------------------------*/
+static unsigned int register_read(const volatile void* reg) {
+    if (reg == &UCA0RXBUF) {
+        IFG2 &= ~UCA0RXIFG;
+        UCA0STAT &= ~UCOE;
+        return UCA0RXBUF;
+    }
+    if (reg == &UCB0RXBUF) {
+        IFG2 &= ~UCB0RXIFG;
+        UCB0STAT &= ~UCOE;
+        return UCB0RXBUF;
+    }
+    if (reg == &TBR) {
+        TBR = timer_b_count();
+        return TBR;
+    }
+    if (reg == &TBIV) {
+        *(volatile unsigned int*)&TBIV = timer_b_vector();
+        return TBIV;
+    }
+    fprintf(stderr, "msp430_host: HAL_REGISTER_READ without a model (%p)\n", (const void*)reg);
+    abort();
+}
+
+static void register_write(volatile void* reg, unsigned int value) {
+    if (reg == &UCA0TXBUF) {
+        UCA0TXBUF = value;
+        usci_write(&uart_tx, value, UCA0TXIFG, &UCA0STAT, uart_frame_cycles());
+    } else if (reg == &UCB0TXBUF) {
+        UCB0TXBUF = value;
+        usci_write(&spi_tx, value, UCB0TXIFG, &UCB0STAT, spi_frame_cycles());
+    } else {
+        fprintf(stderr, "msp430_host: HAL_REGISTER_WRITE without a model (%p)\n", (void*)reg);
+        abort();
+    }
+}
+
+unsigned int hal_host_register_read(const volatile void* reg) {
+    code_pause();
+    unsigned int value = register_read(reg);
+    code_resume();
+    return value;
+}
+
+void hal_host_register_write(volatile void* reg, unsigned int value) {
+    code_pause();
+    register_write(reg, value);
+    code_resume();
+}
+
+/*------------------------------ память ---------------------------------*/
+/**
+ * Адреса MSP430 для указателей хоста (HAL_ADDRESS): каждому новому объекту выдается окно
+ * в области RAM MSP430, указатели внутри окна получают адреса со смещением.
+ * Адреса вне окон и регистров попадают в отдельную память модели.
+ */
+#define ALIAS_BASE 0x0200
+#define ALIAS_SIZE 0x40
+#define ALIASES 16
+
+static unsigned char* aliases[ALIASES];
+static unsigned int alias_count;
+static unsigned char memory[0x10000];
+
+unsigned int hal_host_address(void* pointer) {
+    unsigned char* p = pointer;
+    unsigned int i;
+    for (i = 0; i < alias_count; i++) {
+        if (p >= aliases[i] && p < aliases[i] + ALIAS_SIZE) {
+            return ALIAS_BASE + i * ALIAS_SIZE + (unsigned int)(p - aliases[i]);
+        }
+    }
+    if (alias_count == ALIASES) {
+        fprintf(stderr, "msp430_host: too many HAL_ADDRESS objects\n");
+        abort();
+    }
+    aliases[alias_count] = p;
+    return ALIAS_BASE + alias_count++ * ALIAS_SIZE;
+}
+
+unsigned char* hal_host_memory(unsigned int address) {
+    address &= 0xFFFF;
+    volatile unsigned char* reg = hal_host_register_at(address);
+    if (reg != NULL) {
+        return (unsigned char*)reg;
+    }
+    if (address >= ALIAS_BASE && address < ALIAS_BASE + alias_count * ALIAS_SIZE) {
+        return aliases[(address - ALIAS_BASE) / ALIAS_SIZE] + (address - ALIAS_BASE) % ALIAS_SIZE;
+    }
+    return &memory[address];
+}
+
+/*------------------------------ intrinsics -----------------------------*/
+static void interrupts_enable() {
+    gie = true;
+    interrupts_deliver();
+}
+
+void __nop(void) {
+}
+
+void __eint(void) {
+    code_pause();
+    interrupts_enable();
+    code_resume();
+}
+
+void __dint(void) {
+    code_pause();
+    gie = false;
+    code_resume();
+}
+
+__istate_t __get_interrupt_state(void) {
+    return gie ? GIE : 0;
+}
+
+void __set_interrupt_state(__istate_t state) {
+    code_pause();
+    if (state & GIE) {
+        interrupts_enable();
+    } else {
+        gie = false;
+    }
+    code_resume();
+}
+
+// LPM: модель идет от события к событию пока прерывание не разбудит процессор
+void __bis_status_register(unsigned int bits) {
+    code_pause();
+    if (bits & CPUOFF) {
+        wake_up = false;
+        gie = gie || (bits & GIE);
+        interrupts_deliver();
+        while (!wake_up) {
+            if (!gie || !periphery_step_until(time_limit)) {
+                hal_host_finish(); // разбудить некому
+            }
+            interrupts_deliver();
+        }
+    } else if (bits & GIE) {
+        interrupts_enable();
+    }
+    code_resume();
+}
+
+void __bic_status_register(unsigned int bits) {
+    if (bits & GIE) {
+        __dint();
+    }
+}
+
+void __low_power_mode_off_on_exit(void) {
+    wake_up = true;
+}
+
+void __delay_cycles(unsigned long int delay) {
+    code_pause();
+    cpu_busy(delay);
+    code_resume();
+}
+
+/*------------------------------ сброс ----------------------------------*/
+static void __attribute__((constructor)) hal_host_reset() {
+    IFG2 = UCA0TXIFG + UCB0TXIFG; // TXBUF свободны после PUC
+    UCA0CTL1 = UCSWRST;
+    UCB0CTL1 = UCSWRST;
+    BCSCTL3 = 0; // кварц уже стабилен (LFXT1OF сброшен)
+    for (int vector = 0; vector < VECTORS; vector++) {
+        interrupts[vector].min_slack = HAL_HOST_NEVER;
+    }
+    const char* time_ms = getenv("MSP430_HOST_TIME_MS");
+    time_limit = (time_ms != NULL ? strtoull(time_ms, NULL, 10) : 1000) * HAL_HOST_CYCLES_PER_MS;
+    const char* rx_start_ms = getenv("MSP430_HOST_RX_START_MS");
+    uart_rx_start = (rx_start_ms != NULL ? strtoull(rx_start_ms, NULL, 10) : 10) * HAL_HOST_CYCLES_PER_MS;
+    const char* cycles = getenv("MSP430_HOST_CYCLES_PER_BLOCK");
+    if (cycles != NULL) {
+        cycles_per_block = strtoull(cycles, NULL, 10);
+    }
+    code_resume();
+}
@@ -0,0 +1,56 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+/**
+ * Модель MSP430F2274 для цели msp430_host (см. hal.h).
+ * Время модели - такты MCLK (16 MHz), от него считаются и ACLK, SMCLK и таймеры.
+ * Периферия (USCI, Timer_B, Timer_A + ADC10, порт 1) продвигается от события к событию,
+ * когда прошивка ждет: спит в LPM0 или опрашивает флаг (HAL_POLL).
+ * Код прошивки между ожиданиями занимает время по числу выполненных базовых блоков
+ * (MSP430_HOST_CYCLES_PER_BLOCK тактов на блок, 0 - мгновенно).
+ *
+ * UART: байты из stdin приходят на RX со скоростью линии, отправленные байты пишутся в stdout.
+ * Модель работает MSP430_HOST_TIME_MS миллисекунд модельного времени (по умолчанию 1000)
+ * или пока не кончится работа: процессор спит и ни одного события впереди.
+ * По окончании в stderr печатается отчет: загрузка процессора, максимальная задержка входа
+ * и минимальный запас (от выхода из обработчика до следующего запроса) каждого прерывания, потери данных.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+
+#define HAL_HOST_MCLK_HZ 16000000UL
+#define HAL_HOST_CYCLES_PER_MS (HAL_HOST_MCLK_HZ / 1000)
+
+typedef unsigned long long hal_host_time; // такты MCLK от старта модели
+#define HAL_HOST_NEVER ((hal_host_time)-1)
+
+hal_host_time hal_host_now();
+
+// тактов MCLK на период SMCLK (делитель из BCSCTL2)
+hal_host_time hal_host_smclk_cycles();
+
+/**
+ * Устройство на шине SPI (USCI_B0 master): байт от MSP430 -> ответный байт.
+ * По умолчанию на шине никого нет и приходят нули.
+ */
+unsigned char hal_host_spi_exchange(unsigned char mosi);
+
+/**
+ * Внешнее устройство модели (например ADS на SPI и DRDY): события по времени и строка отчета.
+ * Регистрируется из конструктора до main().
+ */
+typedef struct {
+    hal_host_time (*next)(void); // время следующего события, HAL_HOST_NEVER - нет
+    void (*fire)(void);
+    void (*report)(FILE* out); // может быть NULL
+} hal_host_device;
+
+void hal_host_device_register(const hal_host_device* device);
+
+// уровень входов порта 1 (bits), фронт по P1IES выставляет P1IFG
+void hal_host_port1_input(unsigned char bits, bool high);
+
+// регистр по адресу MSP430 (host/msp430_registers.c), NULL если по адресу нет регистра
+volatile unsigned char* hal_host_register_at(unsigned int address);
+
+#endif //HAL_HOST_H
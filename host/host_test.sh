@@ -0,0 +1,80 @@
+#!/bin/sh
+# Проверка прошивки на модели платы (ctest): host_test.sh msp430_host batch_decoder
+# 1) запись регистров ADS и чтение назад: тестовый сигнал на канал 1 (CONFIG1..CH1SET),
+#    CH1SET и ID (0x53) читаются через ADS_REGISTER_READ
+# 2) ADS_START_RECORDING: ответ с длиной записи, затем фреймы данных с правильным CRC
+#    и ненулевым тестовым сигналом в канале 1
+# 3) фреймы с неизвестным маркером или коротким размером (0x04, 0x05) возвращаются эхом как broken command,
+#    после них команды разбираются как обычно
+# 4) во время записи 200 записей регистра подряд: очередь команд ADS и чтение измерений не должны
+#    заклинивать (SPI без переполнений, почти все измерения прочитаны)
+# 5) STATUS_REQUEST до записи: ответ 0x0D байт с нулевыми счетчиками
+# 6) во время записи 1000 записей регистра подряд (fifo UART переполняется, если команды ждут):
+#    лишние команды отбрасываются, а не склеиваются из обрывков, путь данных не заклинивает
+MSP430_HOST=$1
+BATCH_DECODER=$2
+STREAM=$(mktemp) || exit 1
+trap 'rm -f "$STREAM" "$STREAM.txt" "$STREAM.err"' EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# ADS_REGISTERS_WRITE 0x01: CONFIG1 = 0x02, CONFIG2 = 0xA3 (INT_TEST), LOFF = 0x10, CH1SET = 0x05 (тестовый сигнал)
+# ADS_REGISTER_READ 0x04 (CH1SET), ADS_REGISTER_READ 0x00 (ID)
+# ADS_START_RECORDING делители 1 1
+printf '\252\132\013\260\001\002\243\020\005\125\125\252\132\007\247\004\125\125\252\132\007\247\000\125\125\252\132\010\250\001\001\125\125' |
+    MSP430_HOST_TIME_MS=300 "$MSP430_HOST" > "$STREAM" 2> "$STREAM.err" || fail "msp430_host exited with error"
+
+REPLIES=$(od -An -tx1 -N8 "$STREAM" | tr -d ' \n')
+[ "$REPLIES" = "0553aaa506a80a55" ] || fail "register read and recording replies: $REPLIES (expected 0553aaa506a80a55)"
+
+tail -c +9 "$STREAM" | "$BATCH_DECODER" 1 1 > "$STREAM.txt" 2> "$STREAM.err" || fail "batch_decoder exited with error"
+if grep -q "frames with bad CRC" "$STREAM.err" && ! grep -q ", 0 frames with bad CRC" "$STREAM.err"; then
+    fail "$(cat "$STREAM.err")"
+fi
+FRAMES=$(grep -c '^frame' "$STREAM.txt")
+[ "$FRAMES" -ge 20 ] || fail "$FRAMES data frames decoded (expected at least 20)"
+grep '^  ch1:' "$STREAM.txt" | grep -q '[1-9]' || fail "channel 1 carries no test signal"
+
+# broken: AA 5A 04 55, HELLO, AA 5A 05 AB 55, HELLO
+printf '\252\132\004\125\252\132\006\253\125\125\252\132\005\253\125\252\132\006\253\125\125' |
+    MSP430_HOST_TIME_MS=50 "$MSP430_HOST" > "$STREAM" 2> "$STREAM.err" || fail "msp430_host exited with error on broken frames"
+REPLIES=$(od -An -tx1 "$STREAM" | tr -d ' \n')
+[ "$REPLIES" = "aa5a0455aaa505a055aa5a05ab55aaa505a055" ] || fail "broken frames replies: $REPLIES"
+
+# ADS_START_RECORDING делители 1 1, затем 200 раз ADS_REGISTER_WRITE 0x04 = 0x05
+{
+    printf '\252\132\010\250\001\001\125\125'
+    i=0
+    while [ $i -lt 200 ]; do
+        printf '\252\132\010\246\004\005\125\125'
+        i=$((i + 1))
+    done
+} | MSP430_HOST_TIME_MS=300 "$MSP430_HOST" > "$STREAM" 2> "$STREAM.err" || fail "msp430_host exited with error on command burst"
+grep -q "spi overruns 0," "$STREAM.err" || fail "SPI overrun on command burst: $(grep overruns "$STREAM.err")"
+SAMPLES=$(sed -n 's/.*samples read \([0-9]*\).*/\1/p' "$STREAM.err")
+[ "${SAMPLES:-0}" -ge 450 ] || fail "command burst: $(grep 'samples read' "$STREAM.err") (expected at least 450 read)"
+
+# STATUS_REQUEST
+printf '\252\132\006\264\125\125' |
+    MSP430_HOST_TIME_MS=50 "$MSP430_HOST" > "$STREAM" 2> "$STREAM.err" || fail "msp430_host exited with error on status request"
+REPLIES=$(od -An -tx1 "$STREAM" | tr -d ' \n')
+[ "$REPLIES" = "aaa50db4000000000000000055" ] || fail "status reply: $REPLIES"
+
+# ADS_START_RECORDING делители 1 1, затем 1000 раз ADS_REGISTER_WRITE 0x04 = 0x05
+{
+    printf '\252\132\010\250\001\001\125\125'
+    i=0
+    while [ $i -lt 1000 ]; do
+        printf '\252\132\010\246\004\005\125\125'
+        i=$((i + 1))
+    done
+} | MSP430_HOST_TIME_MS=300 "$MSP430_HOST" > "$STREAM" 2> "$STREAM.err" || fail "msp430_host exited with error on long command burst"
+grep -q "spi overruns 0," "$STREAM.err" || fail "SPI overrun on long command burst: $(grep overruns "$STREAM.err")"
+grep -q "unknown 0$" "$STREAM.err" || fail "long command burst: spliced commands reached ADS: $(grep 'samples read' "$STREAM.err")"
+SAMPLES=$(sed -n 's/.*samples read \([0-9]*\).*/\1/p' "$STREAM.err")
+[ "${SAMPLES:-0}" -ge 350 ] || fail "long command burst: $(grep 'samples read' "$STREAM.err") (expected at least 350 read)"
+
+echo "$FRAMES data frames, CRC ok, CH1SET = 0x05, ID = 0x53"
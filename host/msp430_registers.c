@@ -0,0 +1,49 @@
+/**
+ * Регистры MSP430F2274 для цели msp430_host: каждый sfr из msp430f2274.h становится
+ * обычной переменной (с тем же именем символа __REG, что и в iomacros.h),
+ * плюс таблица адрес -> переменная для доступа по адресу MSP430 (hal_host_memory).
+ */
+#include <stddef.h>
+#include "iomacros.h"
+
+#undef sfrb
+#undef sfrw
+#undef sfra
+#undef const_sfrb
+#undef const_sfrw
+#undef const_sfra
+
+// первый проход: определения переменных
+#define sfrb(x, x_) sfrb_(x, x_)
+#define sfrw(x, x_) sfrw_(x, x_)
+#define sfra(x, x_) sfra_(x, x_)
+#define const_sfrb(x, x_) sfrb_(x, x_)
+#define const_sfrw(x, x_) sfrw_(x, x_)
+#define const_sfra(x, x_) sfra_(x, x_)
+#include "msp430f2274.h"
+
+#include "host/hal_host.h"
+
+#undef sfrb
+#undef sfrw
+#undef sfra
+#undef const_sfrb
+#undef const_sfrw
+#undef const_sfra
+
+/**
+ * Второй проход по заголовку внутри функции: каждая строка "sfrb(REG, REG_);" становится
+ * проверкой адреса. Регистры MSP430 little endian, как и хост, поэтому байт слова - смещение в переменной.
+ */
+#define sfrb(x, x_) if ((unsigned int)(address - (x_)) < sizeof(x)) return (volatile unsigned char*)&(x) + (address - (x_))
+#define sfrw(x, x_) sfrb(x, x_)
+#define sfra(x, x_) sfrb(x, x_)
+#define const_sfrb(x, x_) sfrb(x, x_)
+#define const_sfrw(x, x_) sfrb(x, x_)
+#define const_sfra(x, x_) sfrb(x, x_)
+
+volatile unsigned char* hal_host_register_at(unsigned int address) {
+#undef __MSP430F2274
+#include "msp430f2274.h"
+    return NULL;
+}
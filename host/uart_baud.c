@@ -0,0 +1,148 @@
+/**
+ * Расчет настроек USCI_A0 (UCA0BR0, UCA0BR1, UCA0MCTL) для UART от ACLK 16 MHz
+ * и проверка ошибки битового тайминга (MSP430x2xx Family User's Guide, 15.3.10 - 15.3.12).
+ * Печатает таблицу для uart_spi.c (uart_baud_rates) и enum для uart_spi.h,
+ * для каждой скорости в комментарии - ошибки передачи и приема в процентах бита.
+ *
+ * Использование: uart_baud [brclk_hz]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define DEFAULT_BRCLK 16000000.0
+#define FRAME_BITS 10 // старт + 8 бит данных + стоп
+/**
+ * Допустимая ошибка передачи и приема (в процентах бита, по худшему биту фрейма):
+ * хуже - скорость в таблицу не попадает. Запас приемника от середины бита делится
+ * с ошибкой часов другой стороны и окном голосования выборок, свою часть ограничиваем 4.5%.
+ */
+#define MAX_ERROR_PERCENT 4.5
+
+static const long baud_rates[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 500000, 921600, 1000000};
+
+// модуляция UCBRSx: для бита i фрейма (i = 0 - старт бит), Table 15-2
+static const unsigned char ucbrs_patterns[8] = {0x00, 0x02, 0x22, 0x2A, 0xAA, 0xAE, 0xEE, 0xFE};
+
+static int ucbrs_bit(int ucbrs, int bit) {
+    return (ucbrs_patterns[ucbrs] >> (bit & 7)) & 1;
+}
+
+typedef struct {
+    int ucbr;
+    int ucbrs;
+    int ucbrf;
+    int ucos16;
+    double error; // максимальная ошибка окончания бита в процентах бита
+    double rx_error; // максимальная ошибка момента выборки бита при приеме в процентах бита
+} setting;
+
+/**
+ * Длительность бита i фрейма в тактах BRCLK по формулам 15.3.10:
+ * low-frequency:  UCBR + mUCBRS(i)
+ * oversampling:   (16 + mUCBRS(i)) * UCBR + UCBRF
+ */
+static double bit_length(const setting* s, int i) {
+    if (s->ucos16) {
+        return (16 + ucbrs_bit(s->ucbrs, i)) * s->ucbr + s->ucbrf;
+    }
+    return s->ucbr + ucbrs_bit(s->ucbrs, i);
+}
+
+// ошибка передачи - максимальное отклонение конца бита от идеального по всем битам фрейма
+static double transmit_error(const setting* s, double brclk, long baud) {
+    double ideal_bit = brclk / baud;
+    double t = 0;
+    double worst = 0;
+    for (int i = 0; i < FRAME_BITS; i++) {
+        t += bit_length(s, i);
+        double error = fabs(t - ideal_bit * (i + 1)) / ideal_bit * 100.0;
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    return worst;
+}
+
+/**
+ * Ошибка приема (15.3.11): приемник ловит спад старт бита с точностью до такта BRCLK,
+ * берет старт бит через половину его длительности (int(UCBR/2) + mUCBRS(0) в low-frequency),
+ * а бит j - через длительности битов 1..j после этого (та же модуляция, что и при передаче).
+ * Ошибка - максимальное отклонение момента выборки от середины идеального бита
+ * с учетом такта синхронизации по старт биту, в процентах бита.
+ */
+static double receive_error(const setting* s, double brclk, long baud) {
+    double ideal_bit = brclk / baud;
+    double t = s->ucos16 ? bit_length(s, 0) / 2 : (int)(s->ucbr / 2) + ucbrs_bit(s->ucbrs, 0);
+    double worst = 0;
+    for (int j = 0; j < FRAME_BITS; j++) {
+        if (j > 0) {
+            t += bit_length(s, j);
+        }
+        double offset = t - ideal_bit * (j + 0.5);
+        double error = fmax(fabs(offset), fabs(offset + 1)) / ideal_bit * 100.0; // спад пойман на 0..1 такт позже
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    return worst;
+}
+
+static setting best_setting(double brclk, long baud) {
+    double n = brclk / baud;
+    setting best = {0, 0, 0, 0, 1e9, 1e9};
+    for (int ucos16 = 0; ucos16 <= 1; ucos16++) {
+        if (ucos16 && n < 16) {
+            continue;
+        }
+        int ucbr = ucos16 ? (int) (n / 16) : (int) n;
+        if (ucbr < 1 || ucbr > 0xFFFF) {
+            continue;
+        }
+        for (int ucbrf = 0; ucbrf <= (ucos16 ? 15 : 0); ucbrf++) {
+            for (int ucbrs = 0; ucbrs < 8; ucbrs++) {
+                setting s = {ucbr, ucbrs, ucbrf, ucos16, 0, 0};
+                s.error = transmit_error(&s, brclk, baud);
+                s.rx_error = receive_error(&s, brclk, baud);
+                // выбираем по худшей из двух ошибок
+                if (fmax(s.error, s.rx_error) < fmax(best.error, best.rx_error)) {
+                    best = s;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    double brclk = argc > 1 ? atof(argv[1]) : DEFAULT_BRCLK;
+    int count = sizeof(baud_rates) / sizeof(baud_rates[0]);
+    setting settings[sizeof(baud_rates) / sizeof(baud_rates[0])];
+
+    printf("// uart_spi.h, generated by host/uart_baud (BRCLK %.0f Hz)\n", brclk);
+    printf("enum {\n");
+    for (int i = 0; i < count; i++) {
+        settings[i] = best_setting(brclk, baud_rates[i]);
+        if (fmax(settings[i].error, settings[i].rx_error) <= MAX_ERROR_PERCENT) {
+            printf("    UART_BAUD_%ld,\n", baud_rates[i]);
+        }
+    }
+    printf("    UART_BAUD_RATES\n};\n\n");
+
+    printf("// uart_spi.c, generated by host/uart_baud (BRCLK %.0f Hz)\n", brclk);
+    printf("static const uart_baud_setting uart_baud_rates[UART_BAUD_RATES] = {\n");
+    for (int i = 0; i < count; i++) {
+        const setting* s = &settings[i];
+        if (fmax(s->error, s->rx_error) > MAX_ERROR_PERCENT) {
+            fprintf(stderr, "%ld: no setting within %.1f%% (best tx %.2f%%, rx %.2f%%)\n",
+                    baud_rates[i], MAX_ERROR_PERCENT, s->error, s->rx_error);
+            continue;
+        }
+        int mctl = (s->ucbrf << 4) | (s->ucbrs << 1) | s->ucos16;
+        printf("    {0x%02X, 0x%02X, 0x%02X}, // %7ld: UCBR %d, UCBRS %d, UCBRF %d, UCOS16 %d, error tx %.2f%%, rx %.2f%%\n",
+               s->ucbr & 0xFF, s->ucbr >> 8, mctl, baud_rates[i], s->ucbr, s->ucbrs, s->ucbrf, s->ucos16,
+               s->error, s->rx_error);
+    }
+    printf("};\n");
+    return 0;
+}
@@ -7,7 +7,20 @@
 #define INTERRUPTS_DISABLE() __disable_interrupt() // Disable Global Interrupts by GIE = 0
 #define SLEEP_WITH_ENABLED_INTERRUPTS()   __bis_SR_register(LPM0_bits + GIE) // Going to LPM0 interrapts enabled
 
-// ВСЕ прерывания должны выставлять этот флаг!
-extern volatile bool interrupt_flag;
+/**
+ * События для main loop: прерывания выставляют биты событий, main loop забирает их все разом
+ * и вызывает только те обработчики, которые на эти события подписаны (см. main.c).
+ * EVENT_SET можно вызывать и из main loop: на MSP430 "events |= x" - одна инструкция bis.b.
+ * Прерывание будит процессор только если есть события (EVENTS_WAKE_UP в конце прерывания).
+ */
+#define EVENT_ADS_DATA    0x01 // измерение ADS готово к чтению/прочитано, SPI свободен от чтения измерения
+#define EVENT_ADS_COMMAND 0x02 // очередь команд ADS изменилась (новая команда, команда выполнена, ADS включен)
+#define EVENT_UART_RX     0x04 // принят байт UART
+#define EVENT_UART_TX     0x08 // дескриптор UART отправлен (в очереди отправки есть место)
+
+extern volatile unsigned char events;
+
+#define EVENT_SET(event) (events |= (event))
+#define EVENTS_WAKE_UP() if (events != 0) __low_power_mode_off_on_exit()
 
 #endif //INTERRUPT_H
@@ -1,7 +1,7 @@
 #ifndef LEDS_H
 #define LEDS_H
 
-#include "msp430f2274.h"
+#include "hal.h"
 
 #define LEDS_INIT() P1DIR |= (BIT5 + BIT6 + BIT7); P1OUT &= ~(BIT5 + BIT6 + BIT7)
 
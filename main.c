@@ -1,4 +1,4 @@
-#include "msp430f2274.h"
+#include "hal.h"
 #include "core_inits.h"
 #include "uart_spi.h"
 #include "leds.h"
@@ -7,8 +7,24 @@
 #include "adc.h"
 #include "databatch.h"
 #include "interrupts.h"
+#include "timer.h"
 
-volatile bool interrupt_flag;
+volatile unsigned char events;
+
+/**
+ * Обработчики событий в порядке приоритета: сначала путь данных
+ */
+typedef struct {
+    unsigned char events; // на какие события подписан обработчик
+    void (*handler)(void);
+} event_handler;
+
+static const event_handler event_handlers[] = {
+    {EVENT_ADS_DATA | EVENT_UART_TX, databatch_process},
+    {EVENT_ADS_DATA | EVENT_ADS_COMMAND, ads_process},
+    {EVENT_UART_RX | EVENT_UART_TX | EVENT_ADS_COMMAND, commands_process},
+};
+#define EVENT_HANDLERS (sizeof(event_handlers) / sizeof(event_handlers[0]))
 
 int main(void){
   stop_watchdog();
@@ -17,23 +33,25 @@ int main(void){
   clock_init();
   uart_init();
   spi_init();
+  timer_init();
   ads_init();
   adc_init();
-  // передаем в ADS ссылку на функцию из ADC10 которую ads будет вызывать в прерывании DRDY при поступлении данных
-    ads_DRDY_interrupt_callback(adc_convert_begin);
    // __bis_SR_register(GIE); // enable global interrupts
     INTERRUPTS_ENABLE();
   while(1){
-      while (interrupt_flag) {
-          interrupt_flag = false;
-          commands_process();
-          databatch_process();
-      }
-      // need to read the interrupt flag again without allowing any new interrupts:
+      // read and clear the events without allowing any new interrupts:
       INTERRUPTS_DISABLE();
-      if (interrupt_flag == false) {
-          SLEEP_WITH_ENABLED_INTERRUPTS(); // an interrupt will cause a wake up and run the while loop
+      unsigned char pending = events;
+      events = 0;
+      if (pending == 0) {
+          SLEEP_WITH_ENABLED_INTERRUPTS(); // an interrupt with an event will cause a wake up and run the loop again
+          continue;
       }
       INTERRUPTS_ENABLE();
+      for (unsigned char i = 0; i < EVENT_HANDLERS; i++) {
+          if (pending & event_handlers[i].events) {
+              event_handlers[i].handler();
+          }
+      }
   }
 }
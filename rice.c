@@ -0,0 +1,106 @@
+#include "utypes.h"
+#include "rice.h"
+
+/**======================== Битовый поток ======================
+Биты пишутся начиная со старшего бита каждого байта.
+Последний неполный байт дополняется нулями (rice_end).
+
+Первое измерение канала во фрейме записывается целиком: 24 бита.
+Остальные измерения записываются как разность с предыдущим измерением того же канала:
+разность берется по модулю 2^24 (знаковое 24-битное число r) и переводится в беззнаковое
+u = 2r при r >= 0 и u = -2r - 1 при r < 0 (zigzag), затем кодируется кодом Райса с параметром k:
+q = u >> k;
+q < RICE_ESCAPE:  q единиц | 0 | k младших бит u
+q >= RICE_ESCAPE: RICE_ESCAPE единиц | 24 бита u
+ =========================================================**/
+
+#define SAMPLE_MASK 0xFFFFFFUL
+#define SAMPLE_SIGN 0x800000UL
+
+static uchar* bit_pointer; // куда будет записан следующий полный байт
+static uchar bit_byte; // накопленные но еще не записанные биты
+static uchar bit_count; // сколько бит накоплено в bit_byte
+
+void rice_begin(uchar* output) {
+    bit_pointer = output;
+    bit_byte = 0;
+    bit_count = 0;
+}
+
+/**
+ * Записывает младшие n бит value (n <= 24) начиная со старшего
+ */
+static void put_bits(unsigned long value, uchar n) {
+    while (n > 0) {
+        uchar take = 8 - bit_count; // сколько бит еще влезет в текущий байт
+        if (take > n) {
+            take = n;
+        }
+        n -= take;
+        bit_byte = (bit_byte << take) | ((uchar)(value >> n) & ((1 << take) - 1));
+        bit_count += take;
+        if (bit_count == 8) {
+            *bit_pointer++ = bit_byte;
+            bit_byte = 0;
+            bit_count = 0;
+        }
+    }
+}
+
+void rice_put_raw(unsigned long sample) {
+    put_bits(sample, 24);
+}
+
+/**
+ * Кодирует разность sample - previous (24-битные измерения) с параметром k.
+ * Возвращает закодированный остаток u (для подбора параметра следующего фрейма)
+ */
+unsigned long rice_put_delta(unsigned long sample, unsigned long previous, uchar k) {
+    unsigned long u = (sample - previous) & SAMPLE_MASK;
+    if (u & SAMPLE_SIGN) { // отрицательная разность
+        u = (((~u) & SAMPLE_MASK) << 1) | 1;
+    } else {
+        u = u << 1;
+    }
+    unsigned long q = u >> k;
+    if (q < RICE_ESCAPE) {
+        uchar unary = (uchar) q;
+        put_bits((1 << (unary + 1)) - 2, unary + 1); // q единиц и 0
+        put_bits(u, k);
+    } else {
+        put_bits((1 << RICE_ESCAPE) - 1, RICE_ESCAPE);
+        put_bits(u, 24);
+    }
+    return u;
+}
+
+/**
+ * Адрес следующего за последним полностью записанным байтом битового потока
+ */
+uchar* rice_position() {
+    return bit_pointer;
+}
+
+/**
+ * Дописывает неполный байт. Возвращает адрес следующего за битовым потоком байта
+ */
+uchar* rice_end() {
+    if (bit_count > 0) {
+        put_bits(0, 8 - bit_count);
+    }
+    return bit_pointer;
+}
+
+/**
+ * Параметр k для следующего фрейма: наименьшее k при котором count * 2^k >= sum,
+ * т.е. 2^k примерно равно среднему остатку
+ */
+uchar rice_parameter(unsigned long residuals_sum, uchar residuals_count) {
+    uchar k = 0;
+    unsigned long scaled = residuals_count;
+    while (scaled < residuals_sum && k < RICE_MAX_PARAMETER) {
+        scaled <<= 1;
+        k++;
+    }
+    return k;
+}
@@ -0,0 +1,21 @@
+#ifndef RICE_H
+#define RICE_H
+
+#include "utypes.h"
+
+/**
+ * Кодирование измерений ADS: разность с предыдущим измерением канала + код Райса (Rice/Golomb).
+ * Только сдвиги и сложения - у MSP430F2274 нет аппаратного умножителя.
+ */
+#define RICE_ESCAPE 8 // столько единиц подряд означает что дальше идет невыгодный для кода остаток целиком (24 бита)
+#define RICE_MAX_BITS (RICE_ESCAPE + 24) // максимальная длина кода одного измерения в битах
+#define RICE_MAX_PARAMETER 23
+
+void rice_begin(uchar* output);
+void rice_put_raw(unsigned long sample);
+unsigned long rice_put_delta(unsigned long sample, unsigned long previous, uchar k);
+uchar* rice_position();
+uchar* rice_end();
+uchar rice_parameter(unsigned long residuals_sum, uchar residuals_count);
+
+#endif //RICE_H
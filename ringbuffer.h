@@ -34,8 +34,27 @@
  *
  *  Реализация взята из https://github.com/pepyakin/msp430-uart/blob/master/msp430-uart/include/ringbuf.h
  * (в гите у меня есть форк на него)
+ *
+ * Если перед #include "ringbuffer.h" определить RINGBUFFER_SIZE (степень двойки, проверяется при компиляции),
+ * то все буферы этого .c файла имеют этот размер, а индексы заворачиваются маской-константой
+ * (index & (RINGBUFFER_SIZE - 1)) вместо сравнения с buff_size.
+ *
+ * Кроме побайтовых ringbuffer_read/ringbuffer_write есть пакетные read_n/write_n
+ * и доступ к непрерывному куску памяти буфера без копирования:
+ *   n = ringbuffer_peek_span(rb, &data); ...разбираем data[0..n-1]...; ringbuffer_commit_read(rb, n);
+ *   n = ringbuffer_write_span(rb, &data); ...пишем в data[0..n-1]...; ringbuffer_commit_write(rb, k);
+ * Кусок заканчивается на конце памяти буфера, остальное доступно следующим вызовом.
  */
 
+#include <string.h>
+
+#ifdef RINGBUFFER_SIZE
+typedef char ringbuffer_size_is_power_of_2[((RINGBUFFER_SIZE) & ((RINGBUFFER_SIZE) - 1)) == 0 ? 1 : -1];
+#define RINGBUFFER_BUFF_SIZE(ringbuf) (RINGBUFFER_SIZE)
+#else
+#define RINGBUFFER_BUFF_SIZE(ringbuf) ((ringbuf)->buff_size)
+#endif
+
 typedef struct
 {
     unsigned char* buffer;
@@ -45,17 +64,34 @@ typedef struct
 } ringbuffer;
 
 
-inline void ringbuffer_init(ringbuffer* ringbuf, unsigned char* buffer, unsigned int buf_size) {
+// buf_size - размер buffer (с RINGBUFFER_SIZE должен быть равен ему)
+static inline void ringbuffer_init(ringbuffer* ringbuf, unsigned char* buffer, unsigned int buf_size) {
     ringbuf->buffer = buffer;
     ringbuf->buff_size = buf_size;
     ringbuf->tail = 0;
     ringbuf->head = 0;
 }
 
+/*
+ * Индекс сдвинутый на n элементов вперед (n <= buff_size) с заворачиванием на начало буфера
+ */
+static inline unsigned int ringbuffer_advance(ringbuffer* ringbuf, unsigned int index, unsigned int n) {
+#ifdef RINGBUFFER_SIZE
+    (void)ringbuf;
+    return (index + n) & (RINGBUFFER_SIZE - 1);
+#else
+    index += n;
+    if (index >= ringbuf->buff_size) {
+        index -= ringbuf->buff_size;
+    }
+    return index;
+#endif
+}
+
 /*
  * Возвращает, пустой ли кольцевой буффер?
  */
-inline bool ringbuffer_empty(ringbuffer* ringbuf) {
+static inline bool ringbuffer_empty(ringbuffer* ringbuf) {
     return ringbuf->head == ringbuf->tail;
 }
 
@@ -64,17 +100,15 @@ inline bool ringbuffer_empty(ringbuffer* ringbuf) {
  * return true(1) if element was written successfully
  * and false(0) if ringbuf is full and element can not be written
  */
-inline bool ringbuffer_write(ringbuffer* ringbuf, unsigned char ch) {
-    unsigned int next_head = (unsigned int) (ringbuf->head + 1);
-    if (next_head == ringbuf->buff_size) {
-        next_head = 0;
-    }
+static inline bool ringbuffer_write(ringbuffer* ringbuf, unsigned char ch) {
+    unsigned int head = ringbuf->head;
+    unsigned int next_head = ringbuffer_advance(ringbuf, head, 1);
 
     if (next_head == ringbuf->tail) { // буфер полон
         return false;
     }
 
-    ringbuf->buffer[ringbuf->head] = ch;
+    ringbuf->buffer[head] = ch;
     ringbuf->head = next_head;
     return true;
 }
@@ -84,18 +118,14 @@ inline bool ringbuffer_write(ringbuffer* ringbuf, unsigned char ch) {
  * return true(1) if element was read successfully
  * and false(0) if ringbuf is empty and element can not be read
  */
-inline bool  ringbuffer_read(ringbuffer* ringbuf, unsigned char* chp) {
+static inline bool  ringbuffer_read(ringbuffer* ringbuf, unsigned char* chp) {
+    unsigned int tail = ringbuf->tail;
     // если буфер пустой
-    if (ringbuf->head == ringbuf->tail) {
+    if (ringbuf->head == tail) {
         return false;
     }
-    *chp = ringbuf->buffer[ringbuf->tail];
-
-    unsigned int next_tail = (unsigned int) (ringbuf->tail + 1);
-    if (next_tail == ringbuf->buff_size) {
-        next_tail = 0;
-    }
-    ringbuf->tail = next_tail;
+    *chp = ringbuf->buffer[tail];
+    ringbuf->tail = ringbuffer_advance(ringbuf, tail, 1);
     return true;
 }
 
@@ -103,9 +133,10 @@ inline bool  ringbuffer_read(ringbuffer* ringbuf, unsigned char* chp) {
 /*
  * Возвращает, сколько элементов находится в буфере (доступно для чтения)
  */
-inline unsigned int ringbuffer_available_for_read(ringbuffer* ringbuf) {
-    long length = ringbuf->head - ringbuf->tail;
-    if (length >= 0) {
+static inline unsigned int ringbuffer_available_for_read(ringbuffer* ringbuf) {
+    unsigned int head = ringbuf->head;
+    unsigned int tail = ringbuf->tail;
+    if (head >= tail) {
         /*
          * Указатель для записи находится спереди или на том же месте
          * как и указатель для чтения (в этом случае буфер пуст).
@@ -115,7 +146,7 @@ inline unsigned int ringbuffer_available_for_read(ringbuffer* ringbuf) {
          * R - ringbuf->tail
          * W - ringbuf->head
          */
-        return length;
+        return head - tail;
     } else {
         /*
          * Указатель для записи находится позади указателя чтения. Это
@@ -124,38 +155,98 @@ inline unsigned int ringbuffer_available_for_read(ringbuffer* ringbuf) {
          *
          * |--W---------R-|
          */
-       return -length - 1;
+       return RINGBUFFER_BUFF_SIZE(ringbuf) - tail + head;
     }
 }
 
 /*
  * Возвращает, сколько элементов буфер может вместить (доступно для записи)
  */
-inline unsigned char ringbuffer_available_for_write(ringbuffer* ringbuf) {
-    unsigned int capacity = (ringbuf->buff_size - 1);
-    long length = ringbuf->head - ringbuf->tail;
-    if (length >= 0) {
-        /*
-         * Указатель для записи находится спереди или на том же месте
-         * как и указатель для чтения (в этом случае буфер пуст).
-         *
-         * |---R-----W----|
-         *
-         * R - ringbuf->tail
-         * W - ringbuf->head
-         */
-        return capacity - length;
-    } else {
-        /*
-         * Указатель для записи находится позади указателя чтения. Это
-         * значит что указатель головы (записи) перешёл на новый круг, в то время как
-         * указатель хвоста (чтения) остался на прежнем кругу.
-         *
-         * |--W---------R-|
-         */
-        return capacity + length + 1;
+static inline unsigned int ringbuffer_available_for_write(ringbuffer* ringbuf) {
+    return (RINGBUFFER_BUFF_SIZE(ringbuf) - 1) - ringbuffer_available_for_read(ringbuf);
+}
+
+/*
+ * Непрерывный кусок данных для чтения прямо из памяти буфера (начиная с tail).
+ * Записывает в *data адрес его начала и возвращает длину (0 - буфер пуст).
+ * Данные остаются в буфере пока не вызван ringbuffer_commit_read.
+ */
+static inline unsigned int ringbuffer_peek_span(ringbuffer* ringbuf, unsigned char** data) {
+    unsigned int head = ringbuf->head;
+    unsigned int tail = ringbuf->tail;
+    *data = ringbuf->buffer + tail;
+    if (head >= tail) {
+        return head - tail;
     }
+    return RINGBUFFER_BUFF_SIZE(ringbuf) - tail; // до конца памяти буфера
+}
+
+/*
+ * Освобождает n прочитанных элементов (n не больше чем вернул ringbuffer_peek_span)
+ */
+static inline void ringbuffer_commit_read(ringbuffer* ringbuf, unsigned int n) {
+    ringbuf->tail = ringbuffer_advance(ringbuf, ringbuf->tail, n);
+}
 
+/*
+ * Непрерывный свободный кусок памяти буфера для записи (начиная с head).
+ * Записывает в *data адрес его начала и возвращает длину (0 - буфер полон).
+ * Записанное становится доступно для чтения после ringbuffer_commit_write.
+ */
+static inline unsigned int ringbuffer_write_span(ringbuffer* ringbuf, unsigned char** data) {
+    unsigned int head = ringbuf->head;
+    unsigned int tail = ringbuf->tail;
+    *data = ringbuf->buffer + head;
+    if (head >= tail) {
+        // до конца памяти буфера, но если tail == 0 последнюю ячейку оставляем пустой
+        return RINGBUFFER_BUFF_SIZE(ringbuf) - head - (tail == 0 ? 1 : 0);
+    }
+    return tail - head - 1;
+}
+
+/*
+ * Делает доступными для чтения n записанных элементов (n не больше чем вернул ringbuffer_write_span)
+ */
+static inline void ringbuffer_commit_write(ringbuffer* ringbuf, unsigned int n) {
+    ringbuf->head = ringbuffer_advance(ringbuf, ringbuf->head, n);
+}
+
+/*
+ * Кладет в буфер до n элементов (сколько поместится), копируя кусками.
+ * Возвращает сколько элементов записано.
+ */
+static inline unsigned int ringbuffer_write_n(ringbuffer* ringbuf, const unsigned char* data, unsigned int n) {
+    unsigned int written = 0;
+    unsigned char* span;
+    unsigned int span_size;
+    while (written < n && (span_size = ringbuffer_write_span(ringbuf, &span)) > 0) {
+        if (span_size > n - written) {
+            span_size = n - written;
+        }
+        memcpy(span, data + written, span_size);
+        ringbuffer_commit_write(ringbuf, span_size);
+        written += span_size;
+    }
+    return written;
+}
+
+/*
+ * Извлекает из буфера до n элементов (сколько есть), копируя кусками.
+ * Возвращает сколько элементов прочитано.
+ */
+static inline unsigned int ringbuffer_read_n(ringbuffer* ringbuf, unsigned char* data, unsigned int n) {
+    unsigned int read = 0;
+    unsigned char* span;
+    unsigned int span_size;
+    while (read < n && (span_size = ringbuffer_peek_span(ringbuf, &span)) > 0) {
+        if (span_size > n - read) {
+            span_size = n - read;
+        }
+        memcpy(data + read, span, span_size);
+        ringbuffer_commit_read(ringbuf, span_size);
+        read += span_size;
+    }
+    return read;
 }
 
 #endif //RINGBUF_H
@@ -0,0 +1,58 @@
+#include "hal.h"
+#include "timer.h"
+#include "interrupts.h"
+
+static void (*timer_callbacks[TIMER_CHANNELS])(void);
+
+// регистры сравнения и управления канала (TBCCR1 - канал 0, TBCCR2 - канал 1)
+static volatile unsigned int* const timer_compare[] = {&TBCCR1, &TBCCR2};
+static volatile unsigned int* const timer_control[] = {&TBCCTL1, &TBCCTL2};
+
+void timer_init() {
+    TBCTL = TBSSEL_2 + MC_2 + TBCLR; // SMCLK, continuous mode
+}
+
+/**
+ * Через ticks тиков (не меньше TIMER_MIN_TICKS) из прерывания будет вызван callback.
+ * Предыдущая задержка канала, если она еще идет, отменяется.
+ */
+void timer_start(TIMER_CHANNEL channel, uint ticks, void (*callback)(void)) {
+    if (ticks < TIMER_MIN_TICKS) {
+        ticks = TIMER_MIN_TICKS;
+    }
+    // между чтением TBR и записью сравнения не должно пройти лишнее время.
+    // Функция вызывается и из прерываний, поэтому прерывания не включаются, а восстанавливаются
+    __istate_t state = __get_interrupt_state();
+    INTERRUPTS_DISABLE();
+    timer_callbacks[channel] = callback;
+    *timer_compare[channel] = HAL_REGISTER_READ(TBR) + ticks;
+    *timer_control[channel] = CCIE; // compare mode, флаг прерывания сброшен
+    __set_interrupt_state(state);
+}
+
+void timer_cancel(TIMER_CHANNEL channel) {
+    *timer_control[channel] = 0;
+}
+
+bool timer_running(TIMER_CHANNEL channel) {
+    return (*timer_control[channel] & CCIE) != 0;
+}
+
+static void timer_expired(TIMER_CHANNEL channel) {
+    *timer_control[channel] = 0; // one-shot: callback может сразу поставить новую задержку
+    timer_callbacks[channel]();
+}
+
+HAL_ISR(TIMERB1_VECTOR, timer_b1_isr) {
+    switch (HAL_REGISTER_READ(TBIV)) { // чтение TBIV сбрасывает флаг обработанного прерывания
+        case TBIV_TBCCR1:
+            timer_expired(TIMER_ADS);
+            break;
+        case TBIV_TBCCR2:
+            timer_expired(TIMER_UART);
+            break;
+        default:
+            break;
+    }
+    EVENTS_WAKE_UP(); // события выставляют callback'и
+}
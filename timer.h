@@ -0,0 +1,28 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include "utypes.h"
+
+/**
+ * Однократные (one-shot) задержки на Timer_B вместо __delay_cycles:
+ * процессор спит пока задержка идет, а по ее окончании из прерывания вызывается callback.
+ * Timer_A занят запуском ADC, поэтому используется Timer_B (SMCLK 2 МГц, непрерывный счет).
+ * Каналы независимы (TBCCR1, TBCCR2), на каждом одновременно может идти только одна задержка.
+ */
+#define TIMER_HZ 2000000 // SMCLK
+#define TIMER_US(us) ((uint)((us) * (TIMER_HZ / 1000000))) // тики в микросекундах
+#define TIMER_MIN_TICKS 4 // меньшую задержку можно не успеть поставить до совпадения
+
+typedef enum {
+    TIMER_ADS, // включение ADS и паузы между байтами команд
+    TIMER_UART, // ожидание окончания передачи перед сменой скорости UART
+    TIMER_CHANNELS
+} TIMER_CHANNEL;
+
+void timer_init();
+void timer_start(TIMER_CHANNEL channel, uint ticks, void (*callback)(void));
+void timer_cancel(TIMER_CHANNEL channel);
+bool timer_running(TIMER_CHANNEL channel);
+
+#endif //TIMER_H
@@ -1,8 +1,12 @@
-#include "msp430f2274.h"
+#include "hal.h"
 #include <stdbool.h>
 #include "utypes.h"
 #include "leds.h"
 #include "interrupts.h"
+#include "uart_spi.h"
+#define RINGBUFFER_SIZE 32 // размер fifo UART RX (степень двойки)
+#include "ringbuffer.h"
+#include "timer.h"
 
 /**
  * Обмен информацией через UART происходит в дуплексном режиме,
@@ -73,8 +77,8 @@
  * TX - TRANSMIT
  */
 /**======================== UART BLOCK==================================*/
-#define UART_RX_BUFFER  UCA0RXBUF //uart receive buffer
-#define UART_TX_BUFFER  UCA0TXBUF //uart transmit buffer
+#define UART_RX_BUFFER  HAL_REGISTER_READ(UCA0RXBUF) //uart receive buffer (чтение сбрасывает UCA0RXIFG)
+#define UART_TX_BUFFER_WRITE(ch)  HAL_REGISTER_WRITE(UCA0TXBUF, ch) //uart transmit buffer
 
 // флаг выставляется когда символ приходит в буфер приемник (RXBUF)
 #define UART_RX_FLAG_CHECK()  (IFG2 & UCA0RXIFG)
@@ -87,18 +91,76 @@
 #define UART_RX_INTERRUPT_ENABLE()  (IE2 |= UCA0RXIE)
 #define UART_TX_INTERRUPT_ENABLE()  (IE2 |= UCA0TXIE)
 #define UART_TX_INTERRUPT_DISABLE()  (IE2 &= ~UCA0TXIE)
+#define UART_TX_INTERRUPT_ENABLED()  (IE2 & UCA0TXIE)
 
 /*------------ UART receive circular fifo buffer ------------*/
-#define UART_RX_FIFO_BUFFER_SIZE 32
+#define UART_RX_FIFO_BUFFER_SIZE RINGBUFFER_SIZE
 static uchar uart_rx_fifo_buffer[UART_RX_FIFO_BUFFER_SIZE];
-static volatile uint uart_rx_buffer_head;
-static volatile uint uart_rx_buffer_tail;
+static ringbuffer uart_rx_fifo; // пишет RX_ISR, читает main loop
+static volatile uint uart_rx_dropped_count; // байты, потерянные из-за полного fifo
 /*__________________________________________________*/
 
-static uchar* uart_tx_data;
-static volatile int uart_tx_data_size;
+/*------------ UART baud rates ------------*/
+typedef struct {
+    uchar br0;
+    uchar br1;
+    uchar mctl;
+} uart_baud_setting;
+
+// uart_spi.c, generated by host/uart_baud (BRCLK 16000000 Hz)
+static const uart_baud_setting uart_baud_rates[UART_BAUD_RATES] = {
+    {0x82, 0x06, 0x0A}, //    9600: UCBR 1666, UCBRS 5, UCBRF 0, UCOS16 0, error tx 0.06%, rx 0.10%
+    {0x41, 0x03, 0x04}, //   19200: UCBR 833, UCBRS 2, UCBRF 0, UCOS16 0, error tx 0.12%, rx 0.16%
+    {0xA0, 0x01, 0x0A}, //   38400: UCBR 416, UCBRS 5, UCBRF 0, UCOS16 0, error tx 0.24%, rx 0.40%
+    {0x15, 0x01, 0x0C}, //   57600: UCBR 277, UCBRS 6, UCBRF 0, UCOS16 0, error tx 0.36%, rx 0.40%
+    {0x8A, 0x00, 0x0E}, //  115200: UCBR 138, UCBRS 7, UCBRF 0, UCOS16 0, error tx 0.72%, rx 0.96%
+    {0x45, 0x00, 0x06}, //  230400: UCBR 69, UCBRS 3, UCBRF 0, UCOS16 0, error tx 1.44%, rx 1.84%
+    {0x22, 0x00, 0x0A}, //  460800: UCBR 34, UCBRS 5, UCBRF 0, UCOS16 0, error tx 4.32%, rx 4.24%
+    {0x20, 0x00, 0x00}, //  500000: UCBR 32, UCBRS 0, UCBRF 0, UCOS16 0, error tx 0.00%, rx 3.12%
+};
+
+static volatile uchar uart_pending_baud_rate = UART_BAUD_RATES; // UART_BAUD_RATES - переключение не ожидается
+/*__________________________________________________*/
+
+/*------------ UART transmit queue ------------*/
+/**
+ * Очередь дескрипторов (адрес, размер) на отправку. TX_ISR отправляет их строго по порядку,
+ * один за другим, без участия main loop.
+ * uart_tx_queue_head меняет только main loop (uart_transmit),
+ * uart_tx_queue_tail - только TX_ISR (дескриптор tail отправляется, он освобождается когда
+ * его последний байт записан в TXBUF).
+ */
+#define UART_TX_QUEUE_SIZE 8 // в очереди может быть не больше UART_TX_QUEUE_SIZE - 1 дескрипторов
+static uchar* uart_tx_queue_data[UART_TX_QUEUE_SIZE];
+static int uart_tx_queue_size[UART_TX_QUEUE_SIZE];
+static volatile uchar uart_tx_queue_head;
+static volatile uchar uart_tx_queue_tail;
+
+static uchar* uart_tx_data; // следующий байт дескриптора tail
+static volatile int uart_tx_data_size; // сколько байт дескриптора tail осталось отправить
+
+static uchar uart_tx_next(uchar index) {
+    index++;
+    if (index == UART_TX_QUEUE_SIZE) {
+        index = 0;
+    }
+    return index;
+}
+/*__________________________________________________*/
+
+#define UART_BUSY_POLL TIMER_US(100) // период проверки UCBUSY перед сменой скорости (байт на 9600 - около 1 мс)
+
+static void uart_apply_baud_rate(uchar baud_rate) {
+    UCA0CTL1 |= UCSWRST;  //stopping uart
+    UCA0BR0 = uart_baud_rates[baud_rate].br0;
+    UCA0BR1 = uart_baud_rates[baud_rate].br1;
+    // UCA0MCTL, регистр управления модуляцией модуля USCI_A0: UCBRF, UCBRS, UCOS16 (см. host/uart_baud.c)
+    UCA0MCTL = uart_baud_rates[baud_rate].mctl;
+    UCA0CTL1 &= ~UCSWRST; //releasing uart  *Initialize USCI state machine*
+    // UCSWRST сбрасывает разрешения прерываний UART
+    UART_RX_INTERRUPT_ENABLE();
+}
 
-// TODO сделать enum с несколькими скоростями который передавать как параметр в init
 void uart_init() {
     // DEFAULT: parity disabled - LSB - 8bit data - one stop bit - UART mode - Asynchoronous mode (page 434)
 
@@ -107,19 +169,53 @@ void uart_init() {
     UCA0CTL1 |= UCSWRST;  //stopping uart
     UCA0CTL1 |= UCSSEL0;  //uart clock source - ACLK
 
-    //setting the baud rate
-    UCA0BR1 = 0x00;
-    UCA0BR0 = 0x02;
-    // UCA0MCTL, регистр управления модуляцией модуля USCI_A0.
-    UCA0MCTL = 0x37; // Магическое число. Примерно вычисляется по даташиту и экспериментально уточняется.
     // В даташите slas504g.pdf (MSP430F22x2_MSP430F22x4) стр. 69 и дальше указано, что для битов
     // с 1 по 7 порта 3, при установке P3SEL, значение P3DIR может быть любым.
     P3SEL |= (BIT4 + BIT5);
 
-    UCA0CTL1 &= ~UCSWRST; //releasing uart  *Initialize USCI state machine*
+    ringbuffer_init(&uart_rx_fifo, uart_rx_fifo_buffer, UART_RX_FIFO_BUFFER_SIZE);
+    //setting the baud rate, releasing uart and enabling the interrupts
+    uart_apply_baud_rate(UART_DEFAULT_BAUD);
+}
+
+/**
+ * Переключение скорости UART. Скорость меняется не сразу, а когда все поставленные
+ * в очередь данные (в том числе ответ на команду переключения) уйдут на старой скорости
+ * и передатчик освободится (см. uart_baud_rate_process). До этого uart_transmit ничего не принимает.
+ * @return false если такой скорости нет в таблице
+ */
+bool uart_set_baud_rate(uchar baud_rate) {
+    if (baud_rate >= UART_BAUD_RATES) {
+        return false;
+    }
+    uart_pending_baud_rate = baud_rate;
+    return true;
+}
+
+static void uart_busy_poll() {
+    EVENT_SET(EVENT_UART_TX);
+}
 
-    /*---------------- Enabling the interrupts ------------------*/
-    UART_RX_INTERRUPT_ENABLE(); 
+bool uart_baud_rate_pending() {
+    return uart_pending_baud_rate != UART_BAUD_RATES;
+}
+
+/**
+ * Вызывается из main loop: если ожидается переключение скорости, очередь отправки пуста
+ * и последний байт вышел из сдвигового регистра (UCBUSY), переключает скорость. Не блокирует.
+ */
+void uart_baud_rate_process() {
+    if (!uart_baud_rate_pending() || !uart_transmit_finished()) {
+        return; // очередь опустеет - придет EVENT_UART_TX
+    }
+    if (UCA0STAT & UCBUSY) { // последний байт еще в сдвиговом регистре, проверим позже по таймеру
+        if (!timer_running(TIMER_UART)) {
+            timer_start(TIMER_UART, UART_BUSY_POLL, uart_busy_poll);
+        }
+        return;
+    }
+    uart_apply_baud_rate(uart_pending_baud_rate);
+    uart_pending_baud_rate = UART_BAUD_RATES;
 }
 
 /**
@@ -131,40 +227,60 @@ void uart_init() {
 //    // Wait for TX buffer to be ready for new data
 //    while (! UART_TX_FLAG);
 //    // Push data to TX buffer
-//    UART_TX_BUFFER = ch;
+//    UART_TX_BUFFER_WRITE(ch);
 //}
 
 /**
 * Не блокирующая  отправка  напрямую из переданного массива.
-*  Переданный массив нельзя изменять пока все данные не будут отправлены.
-* Также в это время нельзя добавлять другие данные на отправку
-* Для работы по принципу двойной буфферизации
-* (когда есть два массива одинаковой длины -
-* один для отправку а второй в это время заполнять
+* Массив ставится в очередь на отправку после всего что уже поставлено,
+* ждать окончания предыдущей отправки не нужно.
+* Переданный массив нельзя изменять пока он не будет отправлен (см. uart_transmit_pending).
+* @return false если очередь полна (или ожидается переключение скорости) и массив не поставлен на отправку
 */
-void uart_transmit(uchar* data, int data_size) {
-    UART_TX_INTERRUPT_DISABLE(); // выключить прерывания на прием
-    uart_tx_data = data;
-    uart_tx_data_size = data_size;
-    UART_TX_INTERRUPT_ENABLE(); // включить прерывания на прием
+bool uart_transmit(uchar* data, int data_size) {
+    uchar next_head = uart_tx_next(uart_tx_queue_head);
+    if (next_head == uart_tx_queue_tail || uart_baud_rate_pending()) {
+        return false;
+    }
+    if (data_size <= 0) {
+        return true;
+    }
+    uart_tx_queue_data[uart_tx_queue_head] = data;
+    uart_tx_queue_size[uart_tx_queue_head] = data_size;
+    // TX_ISR может отправлять предыдущий дескриптор и менять uart_tx_queue_tail, поэтому выключаем все прерывания
+    INTERRUPTS_DISABLE();
+    if (uart_tx_queue_head == uart_tx_queue_tail) { // очередь была пуста, этот дескриптор отправляется первым
+        uart_tx_data = data;
+        uart_tx_data_size = data_size;
+    }
+    uart_tx_queue_head = next_head;
+    UART_TX_INTERRUPT_ENABLE(); // включить прерывания на передачу
+    INTERRUPTS_ENABLE();
+    return true;
 }
 
 /**
- *  Waits for the transmission of outgoing uart data to complete
+ * @return true если массив data стоит в очереди на отправку или отправляется
+ * (его еще нельзя менять)
  */
-void uart_flush() {
-    while(uart_tx_data_size > 0);  //SLEEP_WITH_ENABLED_INTERRUPTS();
+bool uart_transmit_pending(uchar* data) {
+    uchar index = uart_tx_queue_tail;
+    while (index != uart_tx_queue_head) {
+        if (uart_tx_queue_data[index] == data) {
+            return true;
+        }
+        index = uart_tx_next(index);
+    }
+    return false;
 }
 
 /**
- * @return true если ассинхронная передача по UART завершены
+ * @return true если ассинхронная передача по UART завершена
+ * (все поставленные в очередь данные переданы в UART)
  */
-//bool uart_transmit_finished() {
-//    if(uart_tx_data_size <= 0) {
-//        return true;
-//    }
-//    return false;
-//}
+bool uart_transmit_finished() {
+    return uart_tx_queue_tail == uart_tx_queue_head;
+}
 
 /**
  * Берет элемент из входящего fifo buffer где накапливаются поступающие данные
@@ -173,25 +289,45 @@ void uart_flush() {
  * and false(0) if uart fifo buffer is empty and element can not be read
  */
 bool uart_read(uchar* chp) {
-    // если буфер пустой
-    if (uart_rx_buffer_head == uart_rx_buffer_tail) {
-        return false;
-    }
-    *chp = uart_rx_fifo_buffer[uart_rx_buffer_tail];
+    return ringbuffer_read(&uart_rx_fifo, chp);
+}
 
-    uint next_tail = (uint) (uart_rx_buffer_tail + 1);
-    if (next_tail >= UART_RX_FIFO_BUFFER_SIZE) {
-        next_tail = 0;
-    }
-    uart_rx_buffer_tail = next_tail;
-    return true;
+/**
+ * Непрерывный кусок принятых данных прямо в памяти fifo буфера, без копирования.
+ * Записывает в *data адрес его начала и возвращает длину (0 - ничего не принято).
+ * Данные остаются в буфере пока не вызван uart_read_commit.
+ */
+uint uart_read_span(uchar** data) {
+    return ringbuffer_peek_span(&uart_rx_fifo, data);
+}
+
+/**
+ * Освобождает n байт разобранных из uart_read_span
+ */
+void uart_read_commit(uint n) {
+    ringbuffer_commit_read(&uart_rx_fifo, n);
+}
+
+/**
+ * Сколько еще байт поместится во входящий fifo buffer
+ */
+uint uart_read_space() {
+    return ringbuffer_available_for_write(&uart_rx_fifo);
+}
+
+/**
+ * Сколько принятых байт потеряно из-за переполнения входящего fifo buffer
+ * (счетчик растет по кругу)
+ */
+uint uart_rx_dropped() {
+    return uart_rx_dropped_count;
 }
 
 /**======================== SPI BLOCK==================================*/
-#define NULL 0x00
+#define SPI_DUMMY_BYTE 0x00 // отправляется чтобы прочитать байт
 
-#define SPI_RX_BUFFER  UCB0RXBUF //spi receive buffer
-#define SPI_TX_BUFFER  UCB0TXBUF //spi transmit buffer
+#define SPI_RX_BUFFER  HAL_REGISTER_READ(UCB0RXBUF) //spi receive buffer (чтение сбрасывает UCB0RXIFG)
+#define SPI_TX_BUFFER_WRITE(ch)  HAL_REGISTER_WRITE(UCB0TXBUF, ch) //spi transmit buffer
 
 // флаг выставляется когда символ приходит в буфер приемник (SPI RXBUF)
 #define SPI_RX_FLAG_CHECK()  (IFG2 & UCB0RXIFG)
@@ -209,6 +345,7 @@ bool uart_read(uchar* chp) {
 #define SPI_TX_INTERRUPT_ENABLE()  (IE2 |= UCB0TXIE)
 #define SPI_RX_INTERRUPT_DISABLE()  (IE2 &= ~UCB0RXIE)
 #define SPI_TX_INTERRUPT_DISABLE()  (IE2 &= ~UCB0TXIE)
+#define SPI_TX_INTERRUPT_ENABLED()  (IE2 & UCB0TXIE)
 
 /*---- ссылка на буфер куда будут сохраняться поступающие данные-----*/
 static volatile uchar* spi_rx_data;
@@ -218,8 +355,18 @@ static volatile int spi_rx_data_size;
 static volatile uchar* spi_tx_data;
 static volatile int spi_tx_data_size;
 
+/*---- чтение "вразброс" (scatter): данные раскладываются группами по group_size байт
+ по адресам из массива spi_rx_groups. Байты внутри группы пишутся в обратном порядке -----*/
+static uchar** spi_rx_groups;
+static uchar spi_rx_group_size;
+static uchar spi_rx_group_left; // сколько байт осталось записать в текущую группу
+static volatile bool scatter_available; //true поступающие данные раскладываются по группам spi_rx_groups
+
+// вызывается из RX_ISR когда принят последний байт неблокирующего обмена (см. spi_transfer_callback)
+static void (*spi_transfer_complete)(void);
+
 static volatile bool read_available; //true поступающие данные сохраняются в буфер spi_rx_data
-static volatile bool transmit_available; //true данные отправляются из буффера spi_tx_data, false вместо данных отправляется NULL
+static volatile bool transmit_available; //true данные отправляются из буффера spi_tx_data, false вместо данных отправляется SPI_DUMMY_BYTE
 
 void spi_init() {
     UCB0CTL1 |= UCSWRST;                          //Stopping SPI
@@ -244,20 +391,45 @@ void spi_init() {
 }
 
 /**
- * Блокирующая операция отправки и получения! Transmit and receive one byte by the SPI
- * Отправляет 1 байт, ждет получения 1 байта и возвращает его.
- * Не применять одновременно с неблокирующи  SPI обменом
- * использующим прерывания! Результат не предсказуем
- * PS этот метод в ардуино библиотеках обычно называют spi_transfer
+ * Блокирующее чтение data_size байт опросом флагов, без прерываний.
+ * Следующий байт ставится в TXBUF пока принимается текущий, поэтому байты идут по шине подряд.
+ * Для чтения из обработчиков прерываний (см. ADS_READ_IN_DRDY_ISR).
+ * Не применять пока идет неблокирующий SPI обмен!
  */
-uchar spi_exchange(uchar tx_data) {
+void spi_read_polled(uchar* read_buffer, uchar data_size) {
     SPI_RX_INTERRUPT_DISABLE(); // Выключаем прерывание на прием по SPI
     SPI_TX_INTERRUPT_DISABLE(); // Выключаем прерывание на получение по SPI
-    while (!SPI_TX_FLAG_CHECK()); // Wait for TXBUF ready
-    SPI_TX_BUFFER = tx_data;         // Send data
-    while (SPI_BUSY_FLAG_CHECK());   // Wait for TX and RX to complete
-    uchar rx_data = SPI_RX_BUFFER; // Read received data
-    return rx_data;
+    while (!SPI_TX_FLAG_CHECK()) { // Wait for TXBUF ready
+        HAL_POLL();
+    }
+    SPI_TX_BUFFER_WRITE(SPI_DUMMY_BYTE);
+    while (data_size-- > 0) {
+        if (data_size > 0) {
+            while (!SPI_TX_FLAG_CHECK()) { // следующий байт ждет в TXBUF
+                HAL_POLL();
+            }
+            SPI_TX_BUFFER_WRITE(SPI_DUMMY_BYTE);
+        }
+        while (!SPI_RX_FLAG_CHECK()) {
+            HAL_POLL();
+        }
+        *read_buffer++ = SPI_RX_BUFFER;
+    }
+}
+
+/**
+ * Неблокирующий обмен идет по одному байту: первый байт ставит в TXBUF TX_ISR (и выключает свое
+ * прерывание), каждый следующий - RX_ISR, забрав предыдущий принятый. Так на шине не больше одного
+ * непрочитанного байта, и поздний RX_ISR (занятый процессор) не приводит к переполнению UCB0RXBUF,
+ * после которого обмен никогда бы не завершился.
+ */
+static void spi_send_next() {
+    if (transmit_available) {
+        SPI_TX_BUFFER_WRITE(*spi_tx_data++); // отправляем данные
+    } else {
+        SPI_TX_BUFFER_WRITE(SPI_DUMMY_BYTE); // отправляем ноль чтобы прочитать данные
+    }
+    spi_tx_data_size--;
 }
 
 /**
@@ -274,6 +446,7 @@ void spi_transmit(uchar* data, int data_size) {
     spi_rx_data_size = data_size;
     transmit_available = true;
     read_available = false;
+    scatter_available = false;
     SPI_RX_INTERRUPT_ENABLE();  // Enable Receive  interrupt
     SPI_TX_INTERRUPT_ENABLE(); // Enable Transmit  interrupt
 }
@@ -291,15 +464,40 @@ void spi_read(uchar* read_buffer, int data_size) {
     spi_tx_data_size = data_size;
     transmit_available = false;
     read_available = true;
+    scatter_available = false;
+    SPI_RX_INTERRUPT_ENABLE();  // Enable Receive  interrupt
+    SPI_TX_INTERRUPT_ENABLE(); // Enable Transmit  interrupt
+}
+
+/**
+ * Неблокирующее чтение "вразброс" без промежуточного буфера.
+ * Читается data_size байт (должно быть кратно group_size). Каждые group_size байт записываются
+ * по очередному адресу из массива groups, причем в обратном порядке
+ * (первый пришедший байт группы ложится в groups[i][group_size - 1]).
+ * Так старший байт вперед (как отдает ADS) сразу превращается в Little Endian.
+ * Массив groups и буферы на которые он указывает нельзя менять пока чтение не завершено!
+ */
+void spi_read_scattered(uchar** groups, int data_size, uchar group_size) {
+    SPI_RX_INTERRUPT_DISABLE(); // Выключаем прерывание на прием по SPI
+    SPI_TX_INTERRUPT_DISABLE(); // Выключаем прерывание на получение по SPI
+    spi_rx_groups = groups;
+    spi_rx_group_size = group_size;
+    spi_rx_group_left = 0;
+    spi_rx_data_size = data_size;
+    spi_tx_data_size = data_size;
+    transmit_available = false;
+    read_available = true;
+    scatter_available = true;
     SPI_RX_INTERRUPT_ENABLE();  // Enable Receive  interrupt
     SPI_TX_INTERRUPT_ENABLE(); // Enable Transmit  interrupt
 }
 
 /**
- *  Ждет пока  ассинхронная передача и чтение по SPY будут завершены
+ * Функция которая будет вызываться в прерывании когда неблокирующий обмен
+ * (spi_transmit, spi_read, spi_read_scattered) завершен. Из нее можно сразу запустить следующий обмен.
  */
-void spi_flush() {
-    while(spi_rx_data_size > 0);// SLEEP_WITH_ENABLED_INTERRUPTS();
+void spi_transfer_callback(void (*func)(void)) {
+    spi_transfer_complete = func;
 }
 
 /**
@@ -313,22 +511,14 @@ bool spi_transfer_finished() {
 }
 
 /**======================== UART/SPI TX and RX INTERRUPTS==================================*/
-#pragma vector = USCIAB0RX_VECTOR
-__interrupt void RX_ISR(void) {
+HAL_ISR(USCIAB0RX_VECTOR, RX_ISR) {
     // UART
     if (UART_RX_FLAG_CHECK()) {
-        // Прочитать символ из буфера-приемника
-        uchar ch = UART_RX_BUFFER;
-        // Проверить что uart fifo buffer не полон
-        uint next_head = (uint) (uart_rx_buffer_head + 1);
-        if (next_head >= UART_RX_FIFO_BUFFER_SIZE) {
-            next_head = 0;
-        }
-        if (next_head != uart_rx_buffer_tail) { // буфер неполон
-            // Положить пришедший символ в фифо буффер
-            uart_rx_fifo_buffer[uart_rx_buffer_head] = ch;
-            uart_rx_buffer_head = next_head;
+        // Прочитать символ из буфера-приемника и положить в фифо буффер (если он полон - символ теряется и считается)
+        if (!ringbuffer_write(&uart_rx_fifo, UART_RX_BUFFER)) {
+            uart_rx_dropped_count++;
         }
+        EVENT_SET(EVENT_UART_RX);
     }
     // SPI
     if (SPI_RX_FLAG_CHECK()) {
@@ -338,44 +528,61 @@ __interrupt void RX_ISR(void) {
             // Выключаем прерывание на прием по SPI
             SPI_RX_INTERRUPT_DISABLE();
         } else {
-            if(read_available) {
+            if(scatter_available) {
+                if (spi_rx_group_left == 0) { // переходим к следующей группе, пишем с ее конца
+                    spi_rx_data = *spi_rx_groups++ + (spi_rx_group_size - 1);
+                    spi_rx_group_left = spi_rx_group_size;
+                }
+                *spi_rx_data-- = ch;
+                spi_rx_group_left--;
+            } else if(read_available) {
                 *spi_rx_data++ = ch; // положить символ в буффер для получения данных
             }   
-            spi_rx_data_size--;
+            if (--spi_rx_data_size == 0) {
+                if (spi_transfer_complete != 0) {
+                    spi_transfer_complete(); // события выставляет callback
+                }
+            } else if (spi_tx_data_size > 0) {
+                spi_send_next(); // байт принят, TXBUF давно свободен - отправляем следующий
+            }
         }
     }
-    interrupt_flag = true;
-    __low_power_mode_off_on_exit();
+    EVENTS_WAKE_UP();
 }
 
 int count = 0;
-#pragma vector = USCIAB0TX_VECTOR
-__interrupt void TX_ISR(void) {
+// Вектор общий для UART и SPI, а TXIFG выставлен у обоих всегда, когда TXBUF свободен.
+// Поэтому каждая ветка обслуживается только при своем разрешенном прерывании: иначе, например,
+// при отправке UART ветка SPI запишет байт в TXBUF во время чтения опросом (spi_read_polled)
+HAL_ISR(USCIAB0TX_VECTOR, TX_ISR) {
     // UART
-    if (UART_TX_FLAG_CHECK()) {
-        if (uart_tx_data_size <= 0) { // Исходящий буфер пуст
+    if (UART_TX_INTERRUPT_ENABLED() && UART_TX_FLAG_CHECK()) {
+        if (uart_tx_queue_tail == uart_tx_queue_head) { // очередь пуста
             // Выключаем прерывание на передачу USCI
             UART_TX_INTERRUPT_DISABLE();
         } else {
-            UART_TX_BUFFER = *uart_tx_data++;
-            uart_tx_data_size--;
+            UART_TX_BUFFER_WRITE(*uart_tx_data++);
+            if (--uart_tx_data_size == 0) { // дескриптор отправлен, переходим к следующему
+                uchar next_tail = uart_tx_next(uart_tx_queue_tail);
+                if (next_tail != uart_tx_queue_head) {
+                    uart_tx_data = uart_tx_queue_data[next_tail];
+                    uart_tx_data_size = uart_tx_queue_size[next_tail];
+                }
+                uart_tx_queue_tail = next_tail;
+                EVENT_SET(EVENT_UART_TX);
+            }
         }
     }
     // SPI
-    if (SPI_TX_FLAG_CHECK()) {
+    if (SPI_TX_INTERRUPT_ENABLED() && SPI_TX_FLAG_CHECK()) {
         if (spi_tx_data_size <= 0) { // нечего передавать
             // Выключаем прерывание на передачу SPI
             SPI_TX_INTERRUPT_DISABLE();
         } else {
-            if(transmit_available) {
-                SPI_TX_BUFFER = *spi_tx_data++; // отправляем данные
-            } else {
-                SPI_TX_BUFFER = NULL; // отправляем ноль чтобы прочитать данные
-            }
-            spi_tx_data_size--;
+            spi_send_next(); // первый байт обмена, следующие отправляет RX_ISR
+            SPI_TX_INTERRUPT_DISABLE();
         }
     }
-      interrupt_flag = true;
-    __low_power_mode_off_on_exit();
+    EVENTS_WAKE_UP();
 }
 
@@ -4,18 +4,45 @@
 #include <stdbool.h>
 #include "utypes.h"
 
+/**
+ * Скорости UART (индексы таблицы uart_baud_rates в uart_spi.c).
+ * Таблица и enum генерируются host/uart_baud, не править руками.
+ */
+// uart_spi.h, generated by host/uart_baud (BRCLK 16000000 Hz)
+enum {
+    UART_BAUD_9600,
+    UART_BAUD_19200,
+    UART_BAUD_38400,
+    UART_BAUD_57600,
+    UART_BAUD_115200,
+    UART_BAUD_230400,
+    UART_BAUD_460800,
+    UART_BAUD_500000,
+    UART_BAUD_RATES
+};
+#define UART_DEFAULT_BAUD UART_BAUD_460800
+
 void uart_init();
+bool uart_set_baud_rate(uchar baud_rate);
+bool uart_baud_rate_pending();
+void uart_baud_rate_process();
 bool uart_read(uchar* chp);
-void uart_transmit(uchar *data, int data_size);
-void uart_flush();
+uint uart_read_span(uchar** data);
+void uart_read_commit(uint n);
+uint uart_read_space();
+uint uart_rx_dropped();
+bool uart_transmit(uchar *data, int data_size);
+bool uart_transmit_pending(uchar* data);
+bool uart_transmit_finished();
 
 
 void spi_init();
-uchar spi_exchange(uchar tx_data);
 void spi_transmit(uchar* data, int data_size);
 void spi_read(uchar* read_buffer, int data_size);
+void spi_read_scattered(uchar** groups, int data_size, uchar group_size);
+void spi_read_polled(uchar* read_buffer, uchar data_size);
 bool spi_transfer_finished();
-void spi_flush();
+void spi_transfer_callback(void (*func)(void));
 
 
 #endif //UART_H